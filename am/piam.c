@@ -14,30 +14,23 @@
 #include <sys/mman.h>
 #include <math.h>
 
+#include "../src/RpiFt.h"
+
 #include <sndfile.h>
 
 #define	ln(x) (log(x)/log(2.718281828459045235f))
 #define	BUFFER_LEN	1024*8
 
 int FileFreqTiming;
+ftwriter_t FtWriter;
 // Test program using SNDFILE
 // see http://www.mega-nerd.com/libsndfile/api.html for API
 
 void WriteTone(double Frequency,uint32_t Timing)
 {
-	typedef struct {
-		double Frequency;
-		uint32_t WaitForThisSample;
-	} samplerf_t;
-	samplerf_t RfSample;
-
-	RfSample.Frequency=Frequency;
-	RfSample.WaitForThisSample=Timing; //en 100 de nanosecond
-	//printf("Freq =%f Timing=%d\n",RfSample.Frequency,RfSample.WaitForThisSample);
-	if (write(FileFreqTiming,&RfSample,sizeof(samplerf_t)) != sizeof(samplerf_t)) {
+	if (!FtWrite(&FtWriter,Frequency,Timing)) {
 		fprintf(stderr, "Unable to write sample\n");
 	}
-
 }
 
 int main(int argc, char **argv) {
@@ -76,7 +69,8 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	FileFreqTiming = open(outfilename, O_WRONLY|O_CREAT, 0644);
+	FileFreqTiming = open(outfilename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	FtWriterOpen(&FtWriter,FileFreqTiming,FT_VERSION_2,FT_MODE_RFA,48000);
 
 	/** **/
 	printf ("Reading file : %s\n", infilename );
@@ -115,6 +109,7 @@ int main(int argc, char **argv) {
 
     /* Close input and output files. */
     sf_close (infile) ;
+	FtWriterClose(&FtWriter);
 	close(FileFreqTiming);
 
 	return 0;
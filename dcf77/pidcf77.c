@@ -14,6 +14,8 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
+#include "../src/RpiFt.h"
+
 // Get main process from arduino project : CodingGhost/DCF77-Transmitter
 // Generator for 77,5 kHz (DCF-77) by Jonas woerner (c)
 // Thanks to Jonas
@@ -34,6 +36,7 @@ byte MinutenBits[anzahlMinutenBits] = { 0 };
 byte StundenBits[anzahlStundenBits] = { 0 };
 int parity = 0;
 int FileFreqTiming;
+ftwriter_t FtWriter;
 
 void modulate(byte b);
 void playtone(double Amplitude,uint32_t Timing);
@@ -214,16 +217,8 @@ void modulate(byte b)
 
 void playtone(double Amplitude,uint32_t Timing)
 {
-	typedef struct {
-		double Amplitude;
-		uint32_t WaitForThisSample;
-	} samplerf_t;
-	samplerf_t RfSample;
-	
-	RfSample.Amplitude=Amplitude;
-	RfSample.WaitForThisSample=Timing; //en 100 de nanosecond
 	printf("%f %d\n",Amplitude,Timing);
-	if (write(FileFreqTiming, &RfSample, sizeof(samplerf_t)) != sizeof(samplerf_t)) {
+	if (!FtWrite(&FtWriter,Amplitude,Timing)) {
 		fprintf(stderr, "Unable to write sample\n");
 	}
 }
@@ -233,11 +228,13 @@ int main(int argc, char **argv)
 	if (argc > 1) 
 	{
 		char *sFileFreqTiming=(char *)argv[1];
-		FileFreqTiming = open(argv[1], O_WRONLY|O_CREAT, 0644);
+		FileFreqTiming = open(argv[1], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		FtWriterOpen(&FtWriter,FileFreqTiming,FT_VERSION_2,FT_MODE_RFA,0);
 		
 		DCF_BITS(7,59);
 		loop();
 		playtone(0,1000e6);//last second
+		FtWriterClose(&FtWriter);
 		close(FileFreqTiming);
 	}
 	else
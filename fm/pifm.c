@@ -13,25 +13,19 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
+#include "../src/RpiFt.h"
+
 #include <sndfile.h>
 
 #define		BUFFER_LEN	1024*8
 int FileFreqTiming;
+ftwriter_t FtWriter;
 // Test program using SNDFILE
 // see http://www.mega-nerd.com/libsndfile/api.html for API
 
 void WriteTone(double Frequency,uint32_t Timing)
 {
-	typedef struct {
-		double Frequency;
-		uint32_t WaitForThisSample;
-	} samplerf_t;
-	samplerf_t RfSample;
-
-	RfSample.Frequency=Frequency;
-	RfSample.WaitForThisSample=Timing; //en 100 de nanosecond
-	//printf("Freq =%f Timing=%d\n",RfSample.Frequency,RfSample.WaitForThisSample);
-	if (write(FileFreqTiming, &RfSample, sizeof(samplerf_t)) != sizeof(samplerf_t)) {
+	if (!FtWrite(&FtWriter,Frequency,Timing)) {
 		fprintf(stderr, "Unable to write sample\n");
 	}
 }
@@ -73,7 +67,8 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	FileFreqTiming = open(outfilename, O_WRONLY|O_CREAT, 0644);
+	FileFreqTiming = open(outfilename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	FtWriterOpen(&FtWriter,FileFreqTiming,FT_VERSION_2,FT_MODE_RF,48000);
 
 	/** **/
 	printf ("Reading file : %s\n", infilename ) ;
@@ -103,6 +98,7 @@ int main(int argc, char **argv)
 
     /* Close input and output files. */
     sf_close (infile) ;
+	FtWriterClose(&FtWriter);
 	close(FileFreqTiming);
 
 	return 0;
@@ -41,6 +41,8 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
+#include "../src/RpiFt.h"
+
 #define TONE_SPACING            8789           // ~8.7890625 Hz
 #define BAUD_2                  7812          // CTC value for 2 baud
 #define BAUD_3                  5208          // CTC value for 3 baud
@@ -63,6 +65,7 @@ char tx_buffer[40];
 uint8_t callsign_crc;
 int FileText;
 int FileFreqTiming;
+ftwriter_t FtWriter;
 // Global variables used in ISRs
 volatile bool proceed = false;
 
@@ -206,19 +209,9 @@ void encode_tone(uint8_t tone);
 
 void WriteTone(double Frequency,uint32_t Timing)
 {
-	typedef struct {
-		double Frequency;
-		uint32_t WaitForThisSample;
-	} samplerf_t;
-	samplerf_t RfSample;
-	
-	RfSample.Frequency=Frequency;
-	RfSample.WaitForThisSample=Timing*1000L; //en 100 de nanosecond
-	//printf("Freq =%f Timing=%d\n",RfSample.Frequency,RfSample.WaitForThisSample);
-	if (write(FileFreqTiming, &RfSample,sizeof(samplerf_t)) != sizeof(samplerf_t)) {
+	if (!FtWrite(&FtWriter,Frequency,Timing*1000L)) {
 		fprintf(stderr, "Unable to write sample\n");
 	}
-
 }
 
 void encode_char(int ch)
@@ -349,7 +342,8 @@ int main(int argc, char **argv)
 		//FileText = open(argv[1], O_RDONLY);
 
 		char *sFileFreqTiming=(char *)argv[2];
-		FileFreqTiming = open(argv[2], O_WRONLY|O_CREAT, 0644);
+		FileFreqTiming = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		FtWriterOpen(&FtWriter,FileFreqTiming,FT_VERSION_2,FT_MODE_RF,0);
 	}
 	else
 	{
@@ -374,6 +368,7 @@ int main(int argc, char **argv)
 		WriteTone(0,500000L);
 	}
   
+	FtWriterClose(&FtWriter);
 	close(FileFreqTiming);
 }
  
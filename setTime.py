@@ -16,6 +16,7 @@ import os
 import struct
 from subprocess import call
 import tempfile
+import time
 
 logging.basicConfig()
 logger = logging.getLogger(__name__)
@@ -169,13 +170,11 @@ if __name__ == "__main__":
                 f.write(sample)
                 logger.debug("%s, %s", amplitude, timing)
 
-    print "waiting %s for syncronization..." % start
-    while True:
-        # whaiting for start of minute
-        if datetime.datetime.now() >= start:
-            break
+    print "transmission starts at %s" % start
+    # rpitx primes the DMA then starts it exactly at the start of the minute
     cmd = ["sudo", "./rpitx", "-m", "RFA", "-i",
-           filename, "-f", "77.500"]
+           filename, "-f", "77.500",
+           "--start-at", "%d" % time.mktime(start.timetuple())]
     if args.gpio4:
         cmd.extend(["-c", "1"])
     logger.debug(cmd)
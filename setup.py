@@ -18,6 +18,16 @@ setup(
                 'src/mailbox.c',
                 'src/RpiDma.c',
                 'src/RpiGpio.c',
+                'src/RpiIQ.c',
+                'src/RpiEmu.c',
+                'src/RpiRender.c',
+                'src/RpiSched.c',
+                'src/RpiStat.c',
+                'src/RpiInput.c',
+                'src/RpiStream.c',
+                'src/RpiResample.c',
+                'src/RpiFt.c',
+                'src/RpiCalib.c',
             ],
             extra_link_args=['-lrt', '-lsndfile'],
         ),
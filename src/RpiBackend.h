@@ -0,0 +1,23 @@
+#ifndef RPI_BACKEND
+#define RPI_BACKEND
+
+// Hardware used by RpiTx : real BCM283x peripherals or an in-memory emulator
+// Both set pwm_reg,clk_reg,dma_reg,gpio_reg,pcm_reg,pad_gpios_reg (InitGpio)
+// and virtbase/mbox for the control_data_s arena (AllocArena, sized at each run)
+typedef struct {
+	const char *Name;
+	char (*InitGpio)(void);
+	char (*InitDma)(void *FunctionTerminate, int* skipSignals);
+	char (*AllocArena)(size_t Size); // DMA must be stopped
+	void (*FreeArena)(void);
+	void (*Release)(void); // Undo InitGpio/InitDma and free the DMA arena (pitx_open can be done again)
+} rpitx_backend_t;
+
+extern rpitx_backend_t BackendBcm;
+extern rpitx_backend_t BackendEmulator;
+extern rpitx_backend_t *Backend; // BackendBcm by default
+
+// Emulated DMA time : NsPerCb for each control block + NsPerWord for each extra word of a SRC_INC block
+void EmulatorSetTiming(int NsPerCb,int NsPerWord);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+	DMA calibration cache
+
+	GetDMADelay takes about a second at startup : its results only depend on
+	the board, the kernel (DMA channel usage, bus clocks) and the output, so
+	they are kept by system in a small text file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "RpiCalib.h"
+#include "raspberry_pi_revision.h"
+
+void CalibKey(char *Key,size_t Size,const char *Backend,int DmaChannel,int OutputPin)
+{
+	struct utsname Name;
+	const char *Release="unknown";
+	char *p;
+
+	if(uname(&Name)==0) Release=Name.release;
+	snprintf(Key,Size,"%s/%08x/%s/dma%d/gpio%d",Backend,(unsigned)getRaspberryPiRevision(),Release,DmaChannel,OutputPin);
+	for(p=Key;*p;p++)
+		if((*p==' ')||(*p=='\t')) *p='_';
+}
+
+// Key and fields of one line, 0 if malformed
+static int CalibParse(const char *Line,char *Key,calibentry_t *Entry)
+{
+	long long Time;
+	int Pos,Used,i;
+	if(sscanf(Line,"%127s %d %d %d %lld%n",Key,&Entry->FreqMiniTiming,&Entry->PwmfMargin,&Entry->Ppm,&Time,&Pos)!=5) return 0;
+	Entry->Time=Time;
+	Entry->NbTiming=0;
+	if(sscanf(Line+Pos,"%d%n",&Entry->NbTiming,&Used)==1)
+	{
+		if((Entry->NbTiming<0)||(Entry->NbTiming>CALIB_TIMING_MAX)) return 0;
+		for(i=0;i<Entry->NbTiming;i++)
+		{
+			Pos+=Used;
+			if(sscanf(Line+Pos,"%u%n",&Entry->Timing[i],&Used)!=1) return 0;
+		}
+	}
+	return (Entry->FreqMiniTiming>0)&&(Entry->PwmfMargin>0);
+}
+
+int CalibLoad(const char *File,const char *Key,calibentry_t *Entry)
+{
+	FILE *f=fopen(File,"r");
+	char Line[CALIB_LINE_MAX];
+	char LineKey[CALIB_KEY_MAX];
+	int Found=0;
+
+	if(f==NULL) return 0;
+	while((!Found)&&(fgets(Line,sizeof(Line),f)!=NULL))
+		Found=CalibParse(Line,LineKey,Entry)&&(strcmp(LineKey,Key)==0);
+	fclose(f);
+	return Found;
+}
+
+int CalibSave(const char *File,const char *Key,const calibentry_t *Entry)
+{
+	char Temp[CALIB_LINE_MAX];
+	char Line[CALIB_LINE_MAX];
+	char LineKey[CALIB_KEY_MAX];
+	calibentry_t Other;
+	FILE *In,*Out;
+	int Ok,i;
+
+	snprintf(Temp,sizeof(Temp),"%s.%d",File,(int)getpid());
+	Out=fopen(Temp,"w");
+	if(Out==NULL) return 0;
+	In=fopen(File,"r");
+	if(In!=NULL)
+	{
+		while(fgets(Line,sizeof(Line),In)!=NULL)
+			if(CalibParse(Line,LineKey,&Other)&&(strcmp(LineKey,Key)!=0)) fputs(Line,Out);
+		fclose(In);
+	}
+	fprintf(Out,"%s %d %d %d %lld",Key,Entry->FreqMiniTiming,Entry->PwmfMargin,Entry->Ppm,(long long)Entry->Time);
+	if(Entry->NbTiming>0)
+	{
+		fprintf(Out," %d",Entry->NbTiming);
+		for(i=0;i<Entry->NbTiming;i++)
+			fprintf(Out," %u",Entry->Timing[i]);
+	}
+	fputc('\n',Out);
+	Ok=(fclose(Out)==0);
+	if(Ok) Ok=(rename(Temp,File)==0);
+	if(!Ok) unlink(Temp);
+	return Ok;
+}
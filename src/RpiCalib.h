@@ -0,0 +1,33 @@
+#ifndef RPI_CALIB
+#define RPI_CALIB
+
+#include <stddef.h>
+#include <stdint.h>
+
+// DMA calibration cache : a text file, one line by system
+//   Key FreqMiniTiming PwmfMargin Ppm Time [NbTiming Timing0 ... TimingN-1]
+// Key has no space (CalibKey), Time is when the entry was measured (s since epoch).
+// The timing table (--calib full) is optional : Timing[n] is the ns of a slot of n FrequencyTab words
+
+#define CALIB_CACHE_FILE "/var/cache/rpitx.calibration"
+#define CALIB_KEY_MAX 128
+#define CALIB_LINE_MAX 4096
+#define CALIB_TIMING_MAX 256
+
+typedef struct {
+	int FreqMiniTiming; // ns by FrequencyTab word
+	int PwmfMargin; // ns of the other CBs of a slot
+	int Ppm;
+	int64_t Time;
+	int NbTiming; // 0 : linear model only
+	uint32_t Timing[CALIB_TIMING_MAX];
+} calibentry_t;
+
+// Backend, board revision, kernel release, DMA channel and output pin
+void CalibKey(char *Key,size_t Size,const char *Backend,int DmaChannel,int OutputPin);
+// 1 if File has an entry for Key
+int CalibLoad(const char *File,const char *Key,calibentry_t *Entry);
+// Replace (or add) the entry of Key : other systems are kept, the file is renamed in place. 0 on error
+int CalibSave(const char *File,const char *Key,const calibentry_t *Entry);
+
+#endif
@@ -3,6 +3,15 @@
 #include <signal.h>
 #include "RpiDma.h"
 #include "RpiGpio.h"
+#include "RpiBackend.h"
+
+struct mbox_s mbox={.handle=-1};
+char DMA_CHANNEL;
+page_map_t *page_map;
+uint8_t *virtbase;
+int SampleWords;
+int SampleStepMax;
+struct control_data_s *ctl;
 
 static int compareInts(const void* first, const void* second) 
 {
@@ -17,34 +26,8 @@ static int compareInts(const void* first, const void* second)
 	return 1;
 }
 
-char InitDma(void *FunctionTerminate, int* skipSignals)
+void InitDmaSignals(void *FunctionTerminate, int* skipSignals)
 {
-	DMA_CHANNEL=4;
-	char *line = NULL;
-	size_t size;
-	FILE * flinux = popen("uname -r", "r");
-	if (flinux != NULL && getline(&line, &size, flinux) == -1)
-	{
-		fprintf(stderr, "Could no get Linux version\n");
-	}
-	else
-	{
-		if(line[0]=='3')
-		{
-			printf("Wheezy\n");
-			DMA_CHANNEL=DMA_CHANNEL_WHEEZY;
-		}
-		
-		if(line[0]=='4')
-		{
-			printf("Jessie\n");
-			DMA_CHANNEL=DMA_CHANNEL_JESSIE;
-		}
-
-	}
-	pclose(flinux);
-	//printf("Init DMA\n");
-	
 	int sentinel[] = {0};
 	if (skipSignals == NULL) {
 		skipSignals = sentinel;
@@ -72,6 +55,36 @@ char InitDma(void *FunctionTerminate, int* skipSignals)
 			sigaction(i, &sa, NULL);
 		}
 	}
+}
+
+char InitDma(void *FunctionTerminate, int* skipSignals)
+{
+	DMA_CHANNEL=4;
+	char *line = NULL;
+	size_t size;
+	FILE * flinux = popen("uname -r", "r");
+	if (flinux != NULL && getline(&line, &size, flinux) == -1)
+	{
+		fprintf(stderr, "Could no get Linux version\n");
+	}
+	else
+	{
+		if(line[0]=='3')
+		{
+			printf("Wheezy\n");
+			DMA_CHANNEL=DMA_CHANNEL_WHEEZY;
+		}
+		
+		if(line[0]=='4')
+		{
+			printf("Jessie\n");
+			DMA_CHANNEL=DMA_CHANNEL_JESSIE;
+		}
+
+	}
+	pclose(flinux);
+	//printf("Init DMA\n");
+	InitDmaSignals(FunctionTerminate,skipSignals);
 
 	//NUM_SAMPLES = NUM_SAMPLES_MAX;
 
@@ -89,14 +102,24 @@ char InitDma(void *FunctionTerminate, int* skipSignals)
 		printf("Failed to open mailbox\n");
 		return(0);
 	}
-	printf("%d Size NUM PAGES %d PAGE_SIZE %d\n",(sizeof(struct control_data_s)),NUM_PAGES,PAGE_SIZE); 
-	mbox.mem_ref = mem_alloc(mbox.handle, NUM_PAGES* PAGE_SIZE, PAGE_SIZE, mem_flag);
-	/* TODO: How do we know that succeeded? */
+	return(1);
+}
+
+// Arena for the control blocks and slots, Size is a multiple of PAGE_SIZE
+char AllocDmaArena(size_t Size)
+{
+	mbox.mem_ref = mem_alloc(mbox.handle, Size, PAGE_SIZE, mem_flag);
+	if (mbox.mem_ref == 0)
+	{
+		printf("Failed to allocate %d bytes of GPU memory\n",(int)Size);
+		return(0);
+	}
 	//printf("mem_ref %x\n", mbox.mem_ref);
 	mbox.bus_addr = mem_lock(mbox.handle, mbox.mem_ref);
 	//printf("bus_addr = %x\n", mbox.bus_addr);
-	mbox.virt_addr = mapmem(BUS_TO_PHYS(mbox.bus_addr), NUM_PAGES* PAGE_SIZE);
+	mbox.virt_addr = mapmem(BUS_TO_PHYS(mbox.bus_addr), Size);
 	//printf("virt_addr %p\n", mbox.virt_addr);
+	mbox.size = Size;
 	virtbase = (uint8_t *)((uint32_t *)mbox.virt_addr);
 	//printf("virtbase %p\n", virtbase);
 	return(1);
@@ -117,3 +140,32 @@ uint32_t mem_phys_to_virt(volatile uint32_t phys)
 	//printf("MemtoVirt:Offset=%lx phys=%lx -> %lx\n",offset,phys,result);
 	return result;
 }
+
+void FreeDmaArena(void)
+{
+	if (mbox.virt_addr != NULL) {
+		unmapmem(mbox.virt_addr, mbox.size);
+		//printf("Unmapmem Done\n");
+		mem_unlock(mbox.handle, mbox.mem_ref);
+		//printf("Unmaplock Done\n");
+		mem_free(mbox.handle, mbox.mem_ref);
+		//printf("Unmapfree Done\n");
+		mbox.virt_addr = NULL;
+		mbox.size = 0;
+	}
+}
+
+// Undo InitGpio/InitDma : arena, mailbox and register mappings
+static void ReleaseBcm(void)
+{
+	FreeDmaArena();
+	if(mbox.handle>=0)
+	{
+		mbox_close(mbox.handle);
+		mbox.handle=-1;
+	}
+	ReleaseGpio();
+}
+
+rpitx_backend_t BackendBcm={"bcm283x",InitGpio,InitDma,AllocDmaArena,FreeDmaArena,ReleaseBcm};
+rpitx_backend_t *Backend=&BackendBcm;
@@ -17,6 +17,9 @@
 #include "mailbox.h"
 
 char InitDma(void *FunctionTerminate, int* skipSignals);
+char AllocDmaArena(size_t Size);
+void FreeDmaArena(void);
+void InitDmaSignals(void *FunctionTerminate, int* skipSignals);
 uint32_t mem_virt_to_phys(volatile void *virt);
 uint32_t mem_phys_to_virt(volatile uint32_t phys);
 
@@ -57,14 +60,17 @@ uint32_t mem_phys_to_virt(volatile uint32_t phys);
 
 #define PAGE_SIZE	4096
 #define PAGE_SHIFT	12
-#define NUM_PAGES	((sizeof(struct control_data_s) + PAGE_SIZE - 1) >> PAGE_SHIFT)
 
-struct {
+struct mbox_s {
 	int handle;		/* From mbox_open() */
 	unsigned mem_ref;	/* From mem_alloc() */
 	unsigned bus_addr;	/* From mem_lock() */
 	uint8_t *virt_addr;	/* From mapmem() */
-} mbox;
+	size_t size;		/* Bytes of the arena, 0 : not allocated */
+};
+
+// Globals below are defined once in RpiDma.c : one DMA arena by process
+extern struct mbox_s mbox;
 
 
 // The GPU reserves channels 1, 3, 6, and 7 (kernel mask dma.dmachans=0x7f35)
@@ -82,7 +88,7 @@ struct {
 #define DMA_CHANNEL_JESSIE 5  
 //#define DMA_CHANNEL_PWMFREQUENCY 5
 
-char DMA_CHANNEL;
+extern char DMA_CHANNEL;
 
 //#define DMA_CHANNEL 8
 
@@ -98,31 +104,34 @@ typedef struct {
 	uint32_t physaddr;
 } page_map_t;
 
-page_map_t *page_map;
+extern page_map_t *page_map;
 
- uint8_t *virtbase;
+extern uint8_t *virtbase;
 
 #define PWM_STEP_MAXI 200
 
+// A slot is 2+SampleStepMax words : FrequencyTab only holds the steps of the run
 typedef struct {
-	
-	uint32_t FrequencyTab[PWM_STEP_MAXI];
 	uint32_t Amplitude1;
 	uint32_t Amplitude2;
-	
+	uint32_t FrequencyTab[]; // 8 bytes aligned (FillPwmPattern)
 } sample_t;
 
-
+// DMA arena : control blocks first (cb index math on virtbase), then NUM_SAMPLES packed slots.
+// Laid out at each run from the longest sample (SetupDmaArena)
 struct control_data_s {
-	dma_cb_t cb[NUM_CBS];//+1 ??
-	
-	sample_t sample[NUM_SAMPLES_MAX];
-	
-	
-	
-	
+	dma_cb_t cb[NUM_CBS];
+	uint32_t Slots[];
 };
 
-struct control_data_s *ctl;
+extern int SampleWords; // Words by slot
+extern int SampleStepMax; // FrequencyTab words by slot
+
+extern struct control_data_s *ctl;
+
+static inline sample_t *SampleSlot(struct control_data_s *ctl,int NoSample)
+{
+	return (sample_t *)(ctl->Slots+NoSample*SampleWords);
+}
 
 #endif
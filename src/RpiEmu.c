@@ -0,0 +1,188 @@
+/*
+	In-memory emulation of the DMA/peripheral registers
+
+	Registers are plain heap pages and control_data_s lives in an anonymous
+	mapping. A thread walks the CB chain of DMA_CHANNEL (DMA_CONBLK_AD) while
+	DMA_CS_ACTIVE is set, at NsPerCb (+NsPerWord) per control block.
+	Only copies to the arena itself are done (completion flags).
+	Nothing is output : this is for profiling/benchmarking the refill loop
+	off a Pi.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "RpiDma.h"
+#include "RpiGpio.h"
+#include "RpiBackend.h"
+
+#define EMU_BUS_BASE 0x40000000 // Fake bus address of the arena
+
+static int EmuNsPerCb=450;
+static int EmuNsPerWord=157;
+static pthread_t EmuThread;
+static volatile int EmuRunning=0;
+static pthread_mutex_t EmuArenaLock=PTHREAD_MUTEX_INITIALIZER; // CB walk against arena (re)allocation
+
+void EmulatorSetTiming(int NsPerCb,int NsPerWord)
+{
+	if(NsPerCb>0) EmuNsPerCb=NsPerCb;
+	if(NsPerWord>=0) EmuNsPerWord=NsPerWord;
+}
+
+static volatile uint32_t *EmuRegisters(void)
+{
+	return calloc(1,PAGE_SIZE); // Larger than any *_LEN
+}
+
+static char EmuInitGpio(void)
+{
+	printf("Emulated peripherals (no hardware access)\n");
+	dma_reg = EmuRegisters();
+	pwm_reg = EmuRegisters();
+	clk_reg = EmuRegisters();
+	pcm_reg = EmuRegisters();
+	gpio_reg = EmuRegisters();
+	pad_gpios_reg = EmuRegisters();
+	return 1;
+}
+
+static long EmuCbTime(volatile dma_cb_t *cb)
+{
+	if((cb->info&BCM2708_DMA_SRC_INC)&&(cb->length>4)) // GetDMADelay(0) uses empty CBs
+		return EmuNsPerCb+(long)EmuNsPerWord*(cb->length/4-1);
+	return EmuNsPerCb;
+}
+
+static void *EmuDmaThread(void *arg)
+{
+	struct timespec now,tick={0,20000};
+	long long last,budget=0;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	last=now.tv_sec*1000000000LL+now.tv_nsec;
+	while(EmuRunning)
+	{
+		volatile uint32_t *dma=dma_reg+DMA_CHANNEL*0x40;
+		long long t;
+
+		nanosleep(&tick,NULL);
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		t=now.tv_sec*1000000000LL+now.tv_nsec;
+		if((dma[DMA_CS]&DMA_CS_ACTIVE)==0)
+		{
+			budget=0;
+			last=t;
+			continue;
+		}
+		budget+=t-last;
+		last=t;
+		pthread_mutex_lock(&EmuArenaLock);
+		// Abort (DMA_CS_ACTIVE cleared) is seen between two CBs, a CB outside the arena ends the chain
+		while((dma[DMA_CS]&DMA_CS_ACTIVE)&&(dma[DMA_CONBLK_AD]!=0))
+		{
+			if(dma[DMA_CONBLK_AD]-mbox.bus_addr>=mbox.size)
+			{
+				dma[DMA_CONBLK_AD]=0;
+				break;
+			}
+			volatile dma_cb_t *cb=(volatile dma_cb_t *)(uintptr_t)mem_phys_to_virt(dma[DMA_CONBLK_AD]);
+			long CbTime=EmuCbTime(cb);
+			if(budget<CbTime) break;
+			budget-=CbTime;
+			// Memory destination (burst completion flags) : do the copy, peripherals are not modelled
+			if((cb->dst>=mbox.bus_addr)&&(cb->dst-mbox.bus_addr<mbox.size))
+				memcpy((void *)(uintptr_t)mem_phys_to_virt(cb->dst),(const void *)(uintptr_t)mem_phys_to_virt(cb->src),cb->length);
+			dma[DMA_CONBLK_AD]=cb->next;
+		}
+		if(dma[DMA_CONBLK_AD]==0) // End of chain
+			dma[DMA_CS]=(dma[DMA_CS]&~DMA_CS_ACTIVE)|DMA_CS_END;
+		pthread_mutex_unlock(&EmuArenaLock);
+	}
+	return NULL;
+}
+
+static char EmuInitDma(void *FunctionTerminate, int* skipSignals)
+{
+	DMA_CHANNEL=DMA_CHANNEL_JESSIE;
+	InitDmaSignals(FunctionTerminate,skipSignals);
+
+	mbox.handle=-1;
+	printf("Emulated DMA : %dns/CB %dns/word\n",EmuNsPerCb,EmuNsPerWord);
+
+	// Signals (terminate) must stay on the main thread
+	sigset_t All,Old;
+	sigfillset(&All);
+	pthread_sigmask(SIG_BLOCK,&All,&Old);
+	EmuRunning=1;
+	if(pthread_create(&EmuThread,NULL,EmuDmaThread,NULL)!=0)
+		EmuRunning=0;
+	pthread_sigmask(SIG_SETMASK,&Old,NULL);
+	if(!EmuRunning)
+	{
+		printf("Failed to start emulated DMA\n");
+		return 0;
+	}
+	return 1;
+}
+
+static char EmuAllocArena(size_t Size)
+{
+	int Flags=MAP_PRIVATE|MAP_ANONYMOUS;
+#ifdef MAP_32BIT
+	Flags|=MAP_32BIT; // RpiTx keeps CB addresses in uint32_t
+#endif
+	void *Arena=mmap(NULL,Size,PROT_READ|PROT_WRITE,Flags,-1,0);
+	if((Arena==MAP_FAILED)||((uintptr_t)Arena+Size-1>0xFFFFFFFFUL))
+	{
+		if(Arena!=MAP_FAILED) munmap(Arena,Size);
+		printf("Failed to allocate emulated DMA memory below 4GB\n");
+		return 0;
+	}
+	pthread_mutex_lock(&EmuArenaLock);
+	mbox.virt_addr=Arena;
+	mbox.bus_addr=EMU_BUS_BASE;
+	mbox.size=Size;
+	virtbase=mbox.virt_addr;
+	pthread_mutex_unlock(&EmuArenaLock);
+	return 1;
+}
+
+static void EmuFreeArena(void)
+{
+	pthread_mutex_lock(&EmuArenaLock);
+	if(mbox.virt_addr!=NULL)
+	{
+		munmap(mbox.virt_addr,mbox.size);
+		mbox.virt_addr=NULL;
+		mbox.size=0;
+	}
+	pthread_mutex_unlock(&EmuArenaLock);
+}
+
+static void EmuFreeRegisters(volatile uint32_t **Reg)
+{
+	free((void *)*Reg);
+	*Reg=NULL;
+}
+
+// Undo EmuInitGpio/EmuInitDma
+static void EmuRelease(void)
+{
+	if(EmuRunning)
+	{
+		EmuRunning=0;
+		pthread_join(EmuThread,NULL);
+	}
+	EmuFreeArena();
+	EmuFreeRegisters(&dma_reg);
+	EmuFreeRegisters(&pwm_reg);
+	EmuFreeRegisters(&clk_reg);
+	EmuFreeRegisters(&pcm_reg);
+	EmuFreeRegisters(&gpio_reg);
+	EmuFreeRegisters(&pad_gpios_reg);
+}
+
+rpitx_backend_t BackendEmulator={"emulator",EmuInitGpio,EmuInitDma,EmuAllocArena,EmuFreeArena,EmuRelease};
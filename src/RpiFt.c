@@ -0,0 +1,184 @@
+/*
+	Frequency/Timing files : v1 raw records, v2 delta/run-length coded
+
+	The writer holds the last record until a different one arrives so identical
+	records (tones, silences, constant durations) are sent once with a repeat count.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "RpiFt.h"
+
+#define FT_VALUE_LIMIT (1LL<<59) // Keeps zigzag(delta)<<2 in 64 bits
+
+static uint8_t *PutVarint(uint8_t *p,uint64_t Value)
+{
+	while(Value>=0x80)
+	{
+		*p++=(Value&0x7F)|0x80;
+		Value>>=7;
+	}
+	*p++=Value;
+	return p;
+}
+
+// 0 if Data ends inside the varint (or it is longer than 64 bits)
+static int GetVarint(const uint8_t *Data,size_t Size,size_t *Pos,uint64_t *Value)
+{
+	uint64_t v=0;
+	int Shift;
+	for(Shift=0;(*Pos<Size)&&(Shift<64);Shift+=7)
+	{
+		uint8_t Byte=Data[(*Pos)++];
+		v|=(uint64_t)(Byte&0x7F)<<Shift;
+		if((Byte&0x80)==0)
+		{
+			*Value=v;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int FtFlush(ftwriter_t *W)
+{
+	size_t Done=0;
+	while(Done<W->Used)
+	{
+		ssize_t NbWrite=write(W->Handle,W->Buffer+Done,W->Used-Done);
+		if(NbWrite<=0)
+		{
+			W->Used=0;
+			return 0;
+		}
+		Done+=NbWrite;
+	}
+	W->Used=0;
+	return 1;
+}
+
+// Encode the held record
+static int FtEmit(ftwriter_t *W)
+{
+	int64_t Delta=W->PendValue-W->Value;
+	uint64_t ZigZag=((uint64_t)Delta<<1)^(uint64_t)(Delta>>63);
+	uint64_t Control=ZigZag<<2;
+	uint8_t *p;
+
+	if((W->Used+FT_RECORD_MAX>sizeof(W->Buffer))&&(!FtFlush(W))) return 0;
+	p=W->Buffer+W->Used;
+	if(W->PendTime!=W->Time) Control|=FT_TIME;
+	if(W->PendRepeat>0) Control|=FT_RUN;
+	p=PutVarint(p,Control);
+	if(Control&FT_TIME) p=PutVarint(p,W->PendTime);
+	if(Control&FT_RUN) p=PutVarint(p,W->PendRepeat);
+	W->Used=p-W->Buffer;
+	W->Value=W->PendValue;
+	W->Time=W->PendTime;
+	W->Pending=0;
+	return 1;
+}
+
+int FtWriterOpen(ftwriter_t *W,int Handle,int Version,int Mode,uint32_t SampleRate)
+{
+	memset(W,0,sizeof(ftwriter_t));
+	W->Handle=Handle;
+	W->Version=Version;
+	W->Header.Magic=FT_MAGIC;
+	W->Header.Version=FT_VERSION_2;
+	W->Header.HeaderSize=sizeof(ftheader_t);
+	W->Header.Mode=Mode;
+	W->Header.ValueShift=FT_VALUE_SHIFT;
+	W->Header.TimeUnit=1;
+	W->Header.SampleRate=SampleRate;
+	W->Scale=(double)(1<<FT_VALUE_SHIFT);
+	if(Version==FT_VERSION_1) return 1;
+	memcpy(W->Buffer,&W->Header,sizeof(ftheader_t));
+	W->Used=sizeof(ftheader_t);
+	return FtFlush(W);
+}
+
+int FtWrite(ftwriter_t *W,double Frequency,uint32_t WaitNanoSecond)
+{
+	double Value=round(Frequency*W->Scale);
+	int64_t IntValue;
+	uint32_t Time=(WaitNanoSecond+W->Header.TimeUnit/2)/W->Header.TimeUnit;
+
+	if(W->Version==FT_VERSION_1)
+	{
+		samplerf_t RfSample;
+		memset(&RfSample,0,sizeof(samplerf_t)); // No uninitialized padding in the file
+		RfSample.Frequency=Frequency;
+		RfSample.WaitForThisSample=WaitNanoSecond;
+		if((W->Used+sizeof(samplerf_t)>sizeof(W->Buffer))&&(!FtFlush(W))) return 0;
+		memcpy(W->Buffer+W->Used,&RfSample,sizeof(samplerf_t));
+		W->Used+=sizeof(samplerf_t);
+		return 1;
+	}
+
+	if(Value>=FT_VALUE_LIMIT) Value=FT_VALUE_LIMIT-1;
+	if(Value<=-FT_VALUE_LIMIT) Value=-FT_VALUE_LIMIT+1;
+	IntValue=(int64_t)Value;
+	if(W->Pending)
+	{
+		if((IntValue==W->PendValue)&&(Time==W->PendTime)&&(W->PendRepeat<FT_RUN_MAX))
+		{
+			W->PendRepeat++;
+			return 1;
+		}
+		if(!FtEmit(W)) return 0;
+	}
+	W->Pending=1;
+	W->PendValue=IntValue;
+	W->PendTime=Time;
+	W->PendRepeat=0;
+	return 1;
+}
+
+int FtWriterClose(ftwriter_t *W)
+{
+	if(W->Pending&&(!FtEmit(W))) return 0;
+	return FtFlush(W);
+}
+
+int FtHeaderCheck(ftdecoder_t *Decoder,const void *Data,size_t Size)
+{
+	ftheader_t Header;
+
+	memset(Decoder,0,sizeof(ftdecoder_t));
+	if(Size<sizeof(uint32_t)) return 0;
+	memcpy(&Header.Magic,Data,sizeof(uint32_t));
+	if(Header.Magic!=FT_MAGIC) return 0;
+	if(Size<sizeof(ftheader_t)) return -1;
+	memcpy(&Header,Data,sizeof(ftheader_t));
+	if((Header.Version!=FT_VERSION_2)||(Header.HeaderSize<sizeof(ftheader_t))||(Header.HeaderSize>Size)||(Header.TimeUnit==0)) return -1;
+	Decoder->Header=Header;
+	Decoder->Scale=ldexp(1.0,-Header.ValueShift);
+	return Header.HeaderSize;
+}
+
+int FtDecode(ftdecoder_t *Decoder,const uint8_t *Data,size_t Size,samplerf_t *Record)
+{
+	size_t Pos=0;
+
+	if(Decoder->Repeat>0)
+		Decoder->Repeat--;
+	else
+	{
+		uint64_t Control,ZigZag;
+		uint64_t Time=Decoder->Time;
+		uint64_t Repeat=0;
+		if(!GetVarint(Data,Size,&Pos,&Control)) return -1;
+		if((Control&FT_TIME)&&(!GetVarint(Data,Size,&Pos,&Time))) return -1;
+		if((Control&FT_RUN)&&(!GetVarint(Data,Size,&Pos,&Repeat))) return -1;
+		// Whole record : update the state
+		ZigZag=Control>>2;
+		Decoder->Value+=(int64_t)(ZigZag>>1)^-(int64_t)(ZigZag&1);
+		Decoder->Time=Time;
+		Decoder->Repeat=Repeat;
+	}
+	Record->Frequency=Decoder->Value*Decoder->Scale;
+	Record->WaitForThisSample=Decoder->Time*Decoder->Header.TimeUnit;
+	return Pos;
+}
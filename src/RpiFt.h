@@ -0,0 +1,85 @@
+#ifndef RPI_FT
+#define RPI_FT
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frequency/Timing files (.ft, .rfa) read by rpitx -m RF/RFA
+//
+// v1 : raw samplerf_t records (16 bytes with padding), no header.
+// v2 : ftheader_t then a byte stream of records, host endianness (little endian on the Pi) :
+//   varint Control : zigzag(Value-PreviousValue)<<2 | FT_TIME | FT_RUN
+//   varint Time    : if FT_TIME, new duration in TimeUnit (else the previous one)
+//   varint Repeat  : if FT_RUN, the record is sent Repeat more times
+// Value is fixed point with ValueShift fractional bits, previous Value and Time start at 0.
+// Varints are little endian base 128 (7 bits by byte, bit 7 set : more bytes follow).
+
+typedef struct {
+	double Frequency; // RF : offset from the tuning frequency (Hz), RFA : amplitude (0..32767)
+	uint32_t WaitForThisSample; // ns
+} samplerf_t;
+
+#define FT_MAGIC 0x32544652 // "RFT2"
+#define FT_VERSION_1 1
+#define FT_VERSION_2 2
+
+#define FT_MODE_RF 0
+#define FT_MODE_RFA 1
+
+typedef struct {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t HeaderSize; // Records start after, later versions may append fields
+	uint8_t Mode; // FT_MODE_RF or FT_MODE_RFA
+	uint8_t ValueShift; // Fractional bits of Value
+	uint16_t Reserved;
+	uint32_t TimeUnit; // ns by Time unit
+	uint32_t SampleRate; // Nominal records/s, 0 if not regular (informative)
+} ftheader_t;
+
+#define FT_TIME 1
+#define FT_RUN 2
+#define FT_VALUE_SHIFT 4 // 1/16 Hz
+#define FT_RUN_MAX 65535 // Longer runs are split (bounded latency on pipes)
+#define FT_RECORD_MAX 24 // Bytes of the longest v2 record, also covers the header and a v1 record
+
+// ************************* Writer (pifm, piam, pisstv, pifsq, pidcf77) *************************
+
+typedef struct {
+	int Handle;
+	int Version;
+	ftheader_t Header;
+	double Scale; // Value units by Hz (or by amplitude unit)
+	int64_t Value; // Last record encoded
+	uint32_t Time;
+	int Pending; // Record held to count its repeats
+	int64_t PendValue;
+	uint32_t PendTime;
+	uint32_t PendRepeat;
+	size_t Used;
+	uint8_t Buffer[4096];
+} ftwriter_t;
+
+// Write the header (v2), 0 on write error
+int FtWriterOpen(ftwriter_t *W,int Handle,int Version,int Mode,uint32_t SampleRate);
+// One record, 0 on write error
+int FtWrite(ftwriter_t *W,double Frequency,uint32_t WaitNanoSecond);
+// Write what is buffered (the handle is not closed), 0 on write error
+int FtWriterClose(ftwriter_t *W);
+
+// ************************* Reader (rpitx) *************************
+
+typedef struct {
+	ftheader_t Header;
+	double Scale; // 2^-ValueShift
+	int64_t Value;
+	uint32_t Time;
+	uint32_t Repeat; // Repeats of the last record still to send
+} ftdecoder_t;
+
+// Start of a file : v2 header size (Decoder is reset), 0 for v1 (no header), -1 for an unknown version
+int FtHeaderCheck(ftdecoder_t *Decoder,const void *Data,size_t Size);
+// Next v2 record from Size bytes : bytes used (0 for a repeat), -1 if Data holds no whole record
+int FtDecode(ftdecoder_t *Decoder,const uint8_t *Data,size_t Size,samplerf_t *Record);
+
+#endif
@@ -7,6 +7,16 @@
 static volatile unsigned int BCM2708_PERI_BASE;	
 static uint32_t dram_phys_base;
 
+int model;
+uint32_t mem_flag;
+
+volatile uint32_t *pwm_reg;
+volatile uint32_t *clk_reg;
+volatile uint32_t *dma_reg;
+volatile uint32_t *gpio_reg;
+volatile uint32_t *pcm_reg;
+volatile uint32_t *pad_gpios_reg;
+
 
 char InitGpio()
 {
@@ -52,6 +62,28 @@ void * map_peripheral(uint32_t base, uint32_t len)
 	return vaddr;
 }
 
+// mapmem maps from the start of the page and returns the register address in it
+static void unmap_peripheral(volatile uint32_t **reg, uint32_t len)
+{
+	if(*reg!=NULL)
+	{
+		uintptr_t offset=(uintptr_t)*reg%4096;
+		unmapmem((void *)((uintptr_t)*reg-offset),len+offset);
+		*reg=NULL;
+	}
+}
+
+// Undo InitGpio
+void ReleaseGpio(void)
+{
+	unmap_peripheral(&dma_reg, DMA_LEN);
+	unmap_peripheral(&pwm_reg, PWM_LEN);
+	unmap_peripheral(&clk_reg, CLK_LEN);
+	unmap_peripheral(&pcm_reg, PCM_LEN);
+	unmap_peripheral(&gpio_reg, GPIO_LEN);
+	unmap_peripheral(&pad_gpios_reg, PADS_GPIO_LEN);
+}
+
 
 int gpioSetMode(unsigned gpio, unsigned mode)
 {
@@ -11,18 +11,20 @@
 #include <ctype.h>
 
 char InitGpio(void);
+void ReleaseGpio(void); // Unmap the registers of InitGpio
 
 void DisplayInfo();
 
-int model;
-uint32_t mem_flag;
+// Defined in RpiGpio.c
+extern int model;
+extern uint32_t mem_flag;
 
-volatile uint32_t *pwm_reg;
-volatile uint32_t *clk_reg;
-volatile uint32_t *dma_reg;
-volatile uint32_t *gpio_reg;
-volatile uint32_t *pcm_reg;
-volatile uint32_t *pad_gpios_reg;
+extern volatile uint32_t *pwm_reg;
+extern volatile uint32_t *clk_reg;
+extern volatile uint32_t *dma_reg;
+extern volatile uint32_t *gpio_reg;
+extern volatile uint32_t *pcm_reg;
+extern volatile uint32_t *pad_gpios_reg;
 
 void * map_peripheral(uint32_t base, uint32_t len);
 int gpioSetMode(unsigned gpio, unsigned mode);
@@ -0,0 +1,307 @@
+/*
+	Block IQ to Frequency/Amplitude conversion
+
+	Replace the per sample IQToFreqAmp (sqrt + integer 1 degree arctan2) by a
+	polynomial atan2 and a reciprocal square root working on 4 samples at once.
+	NEON (Pi2/Pi3 with -mfpu=neon), SSE2 (x86 host) or plain C fallback.
+	Speed against the old per sample code : make -C src ../bench-iq && ./bench-iq
+*/
+
+#include <math.h>
+#include "RpiIQ.h"
+
+#if defined(IQ_NO_SIMD)
+// Plain C only : bench-iq builds this copy to compare it with the vector paths
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define IQ_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define IQ_SSE
+#endif
+
+#define IQ_CHUNK 256 // Samples processed by pass (phases are kept on stack)
+#define AMP_MAX 32767.0f
+#define TINY 1e-20f
+
+// atan(a) for a in [0,1], max error around 1e-5 rad
+#define ATAN_C1 0.99997726f
+#define ATAN_C3 -0.33262347f
+#define ATAN_C5 0.19354346f
+#define ATAN_C7 -0.11643287f
+#define ATAN_C9 0.05265332f
+#define ATAN_C11 -0.01172120f
+
+#define F_PI 3.14159265f
+#define F_PI_2 1.57079633f
+
+static inline float FastAtan2(float y,float x)
+{
+	float ax=fabsf(x),ay=fabsf(y);
+	float mx=(ax>ay)?ax:ay;
+	float mn=(ax>ay)?ay:ax;
+	float a=(mx>0)?mn/mx:0;
+	float s=a*a;
+	float r=a*(ATAN_C1+s*(ATAN_C3+s*(ATAN_C5+s*(ATAN_C7+s*(ATAN_C9+s*ATAN_C11)))));
+	if(ay>ax) r=F_PI_2-r;
+	if(x<0) r=F_PI-r;
+	if(y<0) r=-r;
+	return r;
+}
+
+// Scalar version of one sample : phase (0..2PI) and amplitude, return 1 if clipped
+static inline int PolarScalar(float I,float Q,float *Phase,int *Amp)
+{
+	float a=sqrtf((I*I+Q*Q)*0.5f);
+	int Clip=0;
+	if(a>AMP_MAX)
+	{
+		a=AMP_MAX;
+		Clip=1;
+	}
+	*Amp=(int)(a+0.5f);
+	*Phase=F_PI+FastAtan2(I,Q);
+	return Clip;
+}
+
+#ifdef IQ_SSE
+// y=I x=Q, 4 samples
+static inline int PolarSSE(__m128 y,__m128 x,float *Phase,int *Amp)
+{
+	const __m128 SignMask=_mm_set1_ps(-0.0f);
+	__m128 ax=_mm_andnot_ps(SignMask,x);
+	__m128 ay=_mm_andnot_ps(SignMask,y);
+	__m128 mx=_mm_max_ps(ax,ay);
+	__m128 mn=_mm_min_ps(ax,ay);
+	__m128 a=_mm_div_ps(mn,_mm_max_ps(mx,_mm_set1_ps(TINY)));
+	__m128 s=_mm_mul_ps(a,a);
+	__m128 r=_mm_add_ps(_mm_set1_ps(ATAN_C9),_mm_mul_ps(s,_mm_set1_ps(ATAN_C11)));
+	r=_mm_add_ps(_mm_set1_ps(ATAN_C7),_mm_mul_ps(s,r));
+	r=_mm_add_ps(_mm_set1_ps(ATAN_C5),_mm_mul_ps(s,r));
+	r=_mm_add_ps(_mm_set1_ps(ATAN_C3),_mm_mul_ps(s,r));
+	r=_mm_add_ps(_mm_set1_ps(ATAN_C1),_mm_mul_ps(s,r));
+	r=_mm_mul_ps(a,r);
+
+	__m128 m=_mm_cmpgt_ps(ay,ax);
+	r=_mm_or_ps(_mm_and_ps(m,_mm_sub_ps(_mm_set1_ps(F_PI_2),r)),_mm_andnot_ps(m,r));
+	m=_mm_cmplt_ps(x,_mm_setzero_ps());
+	r=_mm_or_ps(_mm_and_ps(m,_mm_sub_ps(_mm_set1_ps(F_PI),r)),_mm_andnot_ps(m,r));
+	r=_mm_xor_ps(r,_mm_and_ps(y,SignMask));
+	_mm_storeu_ps(Phase,_mm_add_ps(r,_mm_set1_ps(F_PI)));
+
+	// Amplitude = r2*rsqrt(r2) with one Newton step
+	__m128 r2=_mm_mul_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y)),_mm_set1_ps(0.5f));
+	__m128 r2c=_mm_max_ps(r2,_mm_set1_ps(TINY));
+	__m128 rs=_mm_rsqrt_ps(r2c);
+	rs=_mm_mul_ps(rs,_mm_sub_ps(_mm_set1_ps(1.5f),_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f),r2c),_mm_mul_ps(rs,rs))));
+	__m128 amp=_mm_mul_ps(r2,rs);
+	__m128 Over=_mm_cmpgt_ps(amp,_mm_set1_ps(AMP_MAX));
+	amp=_mm_min_ps(amp,_mm_set1_ps(AMP_MAX));
+	_mm_storeu_si128((__m128i *)Amp,_mm_cvttps_epi32(_mm_add_ps(amp,_mm_set1_ps(0.5f))));
+	return __builtin_popcount(_mm_movemask_ps(Over));
+}
+#endif
+
+#ifdef IQ_NEON
+static inline int PolarNEON(float32x4_t y,float32x4_t x,float *Phase,int *Amp)
+{
+	float32x4_t ax=vabsq_f32(x);
+	float32x4_t ay=vabsq_f32(y);
+	float32x4_t mx=vmaxq_f32(vmaxq_f32(ax,ay),vdupq_n_f32(TINY));
+	float32x4_t mn=vminq_f32(ax,ay);
+	// No divide on ARMv7 : reciprocal estimate + 2 Newton steps
+	float32x4_t e=vrecpeq_f32(mx);
+	e=vmulq_f32(vrecpsq_f32(mx,e),e);
+	e=vmulq_f32(vrecpsq_f32(mx,e),e);
+	float32x4_t a=vmulq_f32(mn,e);
+	float32x4_t s=vmulq_f32(a,a);
+	float32x4_t r=vmlaq_f32(vdupq_n_f32(ATAN_C9),s,vdupq_n_f32(ATAN_C11));
+	r=vmlaq_f32(vdupq_n_f32(ATAN_C7),s,r);
+	r=vmlaq_f32(vdupq_n_f32(ATAN_C5),s,r);
+	r=vmlaq_f32(vdupq_n_f32(ATAN_C3),s,r);
+	r=vmlaq_f32(vdupq_n_f32(ATAN_C1),s,r);
+	r=vmulq_f32(a,r);
+
+	r=vbslq_f32(vcgtq_f32(ay,ax),vsubq_f32(vdupq_n_f32(F_PI_2),r),r);
+	r=vbslq_f32(vcltq_f32(x,vdupq_n_f32(0)),vsubq_f32(vdupq_n_f32(F_PI),r),r);
+	r=vbslq_f32(vcltq_f32(y,vdupq_n_f32(0)),vnegq_f32(r),r);
+	vst1q_f32(Phase,vaddq_f32(r,vdupq_n_f32(F_PI)));
+
+	float32x4_t r2=vmulq_f32(vmlaq_f32(vmulq_f32(x,x),y,y),vdupq_n_f32(0.5f));
+	float32x4_t r2c=vmaxq_f32(r2,vdupq_n_f32(TINY));
+	float32x4_t rs=vrsqrteq_f32(r2c);
+	rs=vmulq_f32(rs,vrsqrtsq_f32(vmulq_f32(r2c,rs),rs));
+	rs=vmulq_f32(rs,vrsqrtsq_f32(vmulq_f32(r2c,rs),rs));
+	float32x4_t amp=vmulq_f32(r2,rs);
+	uint32x4_t Over=vshrq_n_u32(vcgtq_f32(amp,vdupq_n_f32(AMP_MAX)),31);
+	amp=vminq_f32(amp,vdupq_n_f32(AMP_MAX));
+	vst1q_s32(Amp,vcvtq_s32_f32(vaddq_f32(amp,vdupq_n_f32(0.5f))));
+	uint32x2_t c=vadd_u32(vget_low_u32(Over),vget_high_u32(Over));
+	return vget_lane_u32(vpadd_u32(c,c),0);
+}
+#endif
+
+// Phase difference to frequency, Phase[0] is the last phase of previous chunk
+static void PhaseToFrequency(const float *Phase,int Count,int SampleRate,float *Frequency)
+{
+	const float Scale=SampleRate/(2.0f*F_PI);
+	int n;
+	for(n=0;n<Count;n++)
+	{
+		float dp=Phase[n+1]-Phase[n];
+		if(dp<0) dp+=2.0f*F_PI;
+		Frequency[n]=dp*Scale;
+	}
+}
+
+int IQToFreqAmpBlock(const int16_t *IQ,int Count,int SampleRate,float *PrevPhase,float *Frequency,int *Amp)
+{
+	float Phase[IQ_CHUNK+1];
+	int Clip=0;
+	int Done;
+
+	for(Done=0;Done<Count;Done+=IQ_CHUNK)
+	{
+		int Len=(Count-Done<IQ_CHUNK)?Count-Done:IQ_CHUNK;
+		const int16_t *In=IQ+2*Done;
+		int n=0;
+		Phase[0]=*PrevPhase;
+#ifdef IQ_SSE
+		for(;n+4<=Len;n+=4)
+		{
+			__m128i v=_mm_loadu_si128((const __m128i *)(In+2*n));
+			__m128 x=_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v,16),16)); // Even = Q
+			__m128 y=_mm_cvtepi32_ps(_mm_srai_epi32(v,16)); // Odd = I
+			Clip+=PolarSSE(y,x,Phase+1+n,Amp+Done+n);
+		}
+#endif
+#ifdef IQ_NEON
+		for(;n+4<=Len;n+=4)
+		{
+			int16x4x2_t v=vld2_s16(In+2*n);
+			float32x4_t x=vcvtq_f32_s32(vmovl_s16(v.val[0]));
+			float32x4_t y=vcvtq_f32_s32(vmovl_s16(v.val[1]));
+			Clip+=PolarNEON(y,x,Phase+1+n,Amp+Done+n);
+		}
+#endif
+		for(;n<Len;n++)
+			Clip+=PolarScalar(In[2*n+1],In[2*n],Phase+1+n,Amp+Done+n);
+		PhaseToFrequency(Phase,Len,SampleRate,Frequency+Done);
+		*PrevPhase=Phase[Len];
+	}
+	return Clip;
+}
+
+int IQFloatToFreqAmpBlock(const float *IQ,int Count,int SampleRate,float *PrevPhase,float *Frequency,int *Amp)
+{
+	float Phase[IQ_CHUNK+1];
+	int Clip=0;
+	int Done;
+
+	for(Done=0;Done<Count;Done+=IQ_CHUNK)
+	{
+		int Len=(Count-Done<IQ_CHUNK)?Count-Done:IQ_CHUNK;
+		const float *In=IQ+2*Done;
+		int n=0;
+		Phase[0]=*PrevPhase;
+#ifdef IQ_SSE
+		const __m128 Gain=_mm_set1_ps(AMP_MAX);
+		for(;n+4<=Len;n+=4)
+		{
+			__m128 a=_mm_loadu_ps(In+2*n);
+			__m128 b=_mm_loadu_ps(In+2*n+4);
+			__m128 x=_mm_mul_ps(_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0)),Gain);
+			__m128 y=_mm_mul_ps(_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1)),Gain);
+			Clip+=PolarSSE(y,x,Phase+1+n,Amp+Done+n);
+		}
+#endif
+#ifdef IQ_NEON
+		for(;n+4<=Len;n+=4)
+		{
+			float32x4x2_t v=vld2q_f32(In+2*n);
+			float32x4_t x=vmulq_n_f32(v.val[0],AMP_MAX);
+			float32x4_t y=vmulq_n_f32(v.val[1],AMP_MAX);
+			Clip+=PolarNEON(y,x,Phase+1+n,Amp+Done+n);
+		}
+#endif
+		for(;n<Len;n++)
+			Clip+=PolarScalar(In[2*n+1]*AMP_MAX,In[2*n]*AMP_MAX,Phase+1+n,Amp+Done+n);
+		PhaseToFrequency(Phase,Len,SampleRate,Frequency+Done);
+		*PrevPhase=Phase[Len];
+	}
+	return Clip;
+}
+
+int IQ8ToFreqAmpBlock(const uint8_t *IQ,int Count,int Unsigned,int SampleRate,float *PrevPhase,float *Frequency,int *Amp)
+{
+	float Phase[IQ_CHUNK+1];
+	// cu8 : flip the sign bit to get v-128, then add 0.5 to center on 127.5
+	const uint8_t Flip=Unsigned?0x80:0;
+	const float Offset=Unsigned?0.5f:0.0f;
+	int Clip=0;
+	int Done;
+
+	for(Done=0;Done<Count;Done+=IQ_CHUNK)
+	{
+		int Len=(Count-Done<IQ_CHUNK)?Count-Done:IQ_CHUNK;
+		const uint8_t *In=IQ+2*Done;
+		int n=0;
+		Phase[0]=*PrevPhase;
+#ifdef IQ_SSE
+		const __m128i FlipV=_mm_set1_epi8(Flip);
+		const __m128 OffsetV=_mm_set1_ps(Offset);
+		const __m128 Gain=_mm_set1_ps(256.0f);
+		for(;n+4<=Len;n+=4)
+		{
+			__m128i b=_mm_xor_si128(_mm_loadl_epi64((const __m128i *)(In+2*n)),FlipV);
+			__m128i v=_mm_srai_epi16(_mm_unpacklo_epi8(b,b),8); // 8 bit to 16 bit, sign extended
+			__m128 x=_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v,16),16)); // Even = Q
+			__m128 y=_mm_cvtepi32_ps(_mm_srai_epi32(v,16)); // Odd = I
+			x=_mm_mul_ps(_mm_add_ps(x,OffsetV),Gain);
+			y=_mm_mul_ps(_mm_add_ps(y,OffsetV),Gain);
+			Clip+=PolarSSE(y,x,Phase+1+n,Amp+Done+n);
+		}
+#endif
+#ifdef IQ_NEON
+		const uint8x8_t FlipV=vdup_n_u8(Flip);
+		const float32x4_t OffsetV=vdupq_n_f32(Offset);
+		for(;n+8<=Len;n+=8)
+		{
+			uint8x8x2_t v=vld2_u8(In+2*n);
+			int16x8_t xs=vmovl_s8(vreinterpret_s8_u8(veor_u8(v.val[0],FlipV)));
+			int16x8_t ys=vmovl_s8(vreinterpret_s8_u8(veor_u8(v.val[1],FlipV)));
+			float32x4_t x=vmulq_n_f32(vaddq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(xs))),OffsetV),256.0f);
+			float32x4_t y=vmulq_n_f32(vaddq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(ys))),OffsetV),256.0f);
+			Clip+=PolarNEON(y,x,Phase+1+n,Amp+Done+n);
+			x=vmulq_n_f32(vaddq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(xs))),OffsetV),256.0f);
+			y=vmulq_n_f32(vaddq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(ys))),OffsetV),256.0f);
+			Clip+=PolarNEON(y,x,Phase+5+n,Amp+Done+n+4);
+		}
+#endif
+		for(;n<Len;n++)
+		{
+			float I=((int8_t)(In[2*n+1]^Flip)+Offset)*256.0f;
+			float Q=((int8_t)(In[2*n]^Flip)+Offset)*256.0f;
+			Clip+=PolarScalar(I,Q,Phase+1+n,Amp+Done+n);
+		}
+		PhaseToFrequency(Phase,Len,SampleRate,Frequency+Done);
+		*PrevPhase=Phase[Len];
+	}
+	return Clip;
+}
+
+void IQ16ToFloat(const int16_t *IQ,int Count,float *Out)
+{
+	int n;
+	for(n=0;n<2*Count;n++)
+		Out[n]=IQ[n]*(1.0f/AMP_MAX);
+}
+
+void IQ8ToFloat(const uint8_t *IQ,int Count,int Unsigned,float *Out)
+{
+	const uint8_t Flip=Unsigned?0x80:0;
+	const float Offset=Unsigned?0.5f:0.0f;
+	int n;
+	for(n=0;n<2*Count;n++)
+		Out[n]=((int8_t)(IQ[n]^Flip)+Offset)*(256.0f/AMP_MAX);
+}
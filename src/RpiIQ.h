@@ -0,0 +1,23 @@
+#ifndef RPI_IQ
+#define RPI_IQ
+
+#include <stdint.h>
+
+// Block IQ to polar conversion : a whole DMA burst at once
+// Sample 2*n+1 is taken as I and 2*n as Q (same as the stereo wav layout)
+// Frequency is the phase step converted to Hz (0..SampleRate), Amp is 0..32767
+// PrevPhase keeps the last phase between two bursts
+// Return the number of samples clipped to 32767 (overload)
+int IQToFreqAmpBlock(const int16_t *IQ,int Count,int SampleRate,float *PrevPhase,float *Frequency,int *Amp);
+
+// Same with interleaved float I,Q (-1.0..1.0, scaled by 32767)
+int IQFloatToFreqAmpBlock(const float *IQ,int Count,int SampleRate,float *PrevPhase,float *Frequency,int *Amp);
+
+// Same with 8 bit I/Q (headerless cs8, or cu8 centered on 127.5 when Unsigned), scaled by 256
+int IQ8ToFreqAmpBlock(const uint8_t *IQ,int Count,int Unsigned,int SampleRate,float *PrevPhase,float *Frequency,int *Amp);
+
+// Count int16 or 8 bit I/Q to interleaved float, on the scale of IQFloatToFreqAmpBlock (resampler input)
+void IQ16ToFloat(const int16_t *IQ,int Count,float *Out);
+void IQ8ToFloat(const uint8_t *IQ,int Count,int Unsigned,float *Out);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+	Memory mapped input file
+
+	Block reader : the read() path (pipes, stdin, callbacks) pulls BLOCK_INPUT_SIZE
+	at once and hands out records from memory.
+
+	Mapping : the kernel is told the file is read once from start to end (MADV_SEQUENTIAL)
+	and to start reading ahead now (MADV_WILLNEED), so the input thread only
+	touches pages already in the page cache.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "RpiInput.h"
+
+int MapInputOpen(mapinput_t *In,int Handle,size_t RecordSize)
+{
+	struct stat St;
+	void *Map;
+
+	In->Map=NULL;
+	In->MapSize=0;
+	In->Size=0;
+	In->Offset=0;
+	if(fstat(Handle,&St)!=0) return 0;
+	if(!S_ISREG(St.st_mode)) return 0;
+	if(St.st_size<(off_t)RecordSize) return 0; // Nothing to map : let read() report it
+	Map=mmap(NULL,St.st_size,PROT_READ,MAP_PRIVATE,Handle,0);
+	if(Map==MAP_FAILED) return 0;
+	madvise(Map,St.st_size,MADV_SEQUENTIAL);
+	madvise(Map,St.st_size,MADV_WILLNEED);
+	In->Map=Map;
+	In->MapSize=St.st_size;
+	In->Size=St.st_size-St.st_size%RecordSize;
+	return 1;
+}
+
+void MapInputClose(mapinput_t *In)
+{
+	if(In->Map==NULL) return;
+	munmap((void *)In->Map,In->MapSize);
+	In->Map=NULL;
+	In->Size=0;
+	In->Offset=0;
+}
+
+void MapInputRewind(mapinput_t *In)
+{
+	In->Offset=0;
+}
+
+const void *MapInputNext(mapinput_t *In,size_t Count,int Loop,void *Scratch,int *Wraps)
+{
+	uint8_t *Dest=Scratch;
+	size_t Done=0;
+
+	if(In->Size-In->Offset>=Count)
+	{
+		const void *Data=In->Map+In->Offset;
+		In->Offset+=Count;
+		return Data;
+	}
+	if(!Loop) return NULL;
+	// Across the end of file : copy the tail, then the head (file may be shorter than Count)
+	while(Done<Count)
+	{
+		size_t Len=In->Size-In->Offset;
+		if(Len>Count-Done) Len=Count-Done;
+		memcpy(Dest+Done,In->Map+In->Offset,Len);
+		Done+=Len;
+		In->Offset+=Len;
+		if(In->Offset==In->Size)
+		{
+			In->Offset=0;
+			(*Wraps)++;
+		}
+	}
+	return Scratch;
+}
+
+int BlockInputInit(blockinput_t *In,ssize_t (*Read)(void *buffer,size_t count),size_t Size)
+{
+	In->Read=Read;
+	In->Buffer=malloc(Size);
+	In->Size=Size;
+	In->Begin=0;
+	In->End=0;
+	return In->Buffer!=NULL;
+}
+
+void BlockInputFree(blockinput_t *In)
+{
+	free(In->Buffer);
+	In->Buffer=NULL;
+}
+
+void BlockInputReset(blockinput_t *In)
+{
+	In->Begin=0;
+	In->End=0;
+}
+
+const void *BlockInputNext(blockinput_t *In,size_t Count,int *Status)
+{
+	const void *Record;
+
+	if(In->End-In->Begin<Count)
+	{
+		// Move the partial record to the start, then fill the block (a pipe may return less)
+		memmove(In->Buffer,In->Buffer+In->Begin,In->End-In->Begin);
+		In->End-=In->Begin;
+		In->Begin=0;
+		while(In->End<Count)
+		{
+			ssize_t NbRead=In->Read(In->Buffer+In->End,In->Size-In->End);
+			if(NbRead<=0)
+			{
+				*Status=(In->End==0)?BLOCK_INPUT_EOF:BLOCK_INPUT_SHORT;
+				In->End=0;
+				return NULL;
+			}
+			In->End+=NbRead;
+		}
+	}
+	Record=In->Buffer+In->Begin;
+	In->Begin+=Count;
+	*Status=BLOCK_INPUT_OK;
+	return Record;
+}
+
+const uint8_t *BlockInputPeek(blockinput_t *In,size_t Count,size_t *Avail)
+{
+	if(In->End-In->Begin<Count)
+	{
+		memmove(In->Buffer,In->Buffer+In->Begin,In->End-In->Begin);
+		In->End-=In->Begin;
+		In->Begin=0;
+		while(In->End<Count)
+		{
+			ssize_t NbRead=In->Read(In->Buffer+In->End,In->Size-In->End);
+			if(NbRead<=0) break;
+			In->End+=NbRead;
+		}
+	}
+	*Avail=In->End-In->Begin;
+	return In->Buffer+In->Begin;
+}
@@ -0,0 +1,77 @@
+#ifndef RPI_INPUT
+#define RPI_INPUT
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Memory mapped input file (IQ, IQFLOAT, RF) : bursts are pointers into the mapping,
+// no read() and no copy. Looping wraps the offset, a burst across the end of file
+// is the only one copied (in the caller's buffer).
+// Pipes and stdin can't be mapped : keep the read() path for them.
+typedef struct {
+	const uint8_t *Map;
+	size_t MapSize;
+	size_t Size; // Whole records only
+	size_t Offset;
+} mapinput_t;
+
+// 0 if Handle is not a regular file or can't be mapped (Map stays NULL)
+int MapInputOpen(mapinput_t *In,int Handle,size_t RecordSize);
+void MapInputClose(mapinput_t *In);
+void MapInputRewind(mapinput_t *In);
+
+// Next Count bytes, NULL at end of file when not looping (Offset unchanged, see MapInputLeft)
+// Loop : wrap at end of file, Wraps is incremented each time, Scratch (Count bytes) is used across the end
+const void *MapInputNext(mapinput_t *In,size_t Count,int Loop,void *Scratch,int *Wraps);
+
+// Bytes left before end of file (a partial burst when MapInputNext returned NULL)
+static inline size_t MapInputLeft(const mapinput_t *In)
+{
+	return In->Size-In->Offset;
+}
+
+// Variable length records (.ft v2) : bytes from Offset to the end of file, consumed with MapInputSkip
+static inline const uint8_t *MapInputPeek(const mapinput_t *In,size_t *Avail)
+{
+	*Avail=In->Size-In->Offset;
+	return In->Map+In->Offset;
+}
+
+static inline void MapInputSkip(mapinput_t *In,size_t Count)
+{
+	In->Offset+=Count;
+}
+
+// Buffered record reader over a read() like function (pipes, stdin, python callbacks) :
+// one call per block instead of one per record, records cut by a block are kept for the next one
+#define BLOCK_INPUT_SIZE (64*1024)
+
+#define BLOCK_INPUT_OK 0
+#define BLOCK_INPUT_EOF 1 // End of input on a record boundary
+#define BLOCK_INPUT_SHORT 2 // End of input inside a record : the partial record is dropped
+
+typedef struct {
+	ssize_t (*Read)(void *buffer,size_t count);
+	uint8_t *Buffer;
+	size_t Size;
+	size_t Begin; // Next record
+	size_t End; // Bytes read
+} blockinput_t;
+
+int BlockInputInit(blockinput_t *In,ssize_t (*Read)(void *buffer,size_t count),size_t Size);
+void BlockInputFree(blockinput_t *In);
+// Drop what is buffered (input has been rewound)
+void BlockInputReset(blockinput_t *In);
+// Next record of Count bytes, NULL with Status EOF or SHORT at end of input
+const void *BlockInputNext(blockinput_t *In,size_t Count,int *Status);
+// Variable length records : at least Count bytes buffered (fewer only at end of input),
+// Avail is what is buffered, consumed with BlockInputSkip
+const uint8_t *BlockInputPeek(blockinput_t *In,size_t Count,size_t *Avail);
+
+static inline void BlockInputSkip(blockinput_t *In,size_t Count)
+{
+	In->Begin+=Count;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef RPI_POS
+#define RPI_POS
+
+#include <stdint.h>
+
+// DMA position tracker : free running counts of the slots played and refilled since the
+// DMA was started. The DMA only gives its slot in the ring (CB address, or the last
+// completion flag), Played moves forward by the distance from the previous reading :
+// it must be read at least once by DMA lap.
+// Written-Played is the exact number of slots queued, Played is a sample clock.
+
+typedef struct {
+	uint32_t Base; // Bus address of the first CB
+	uint32_t Reciprocal; // 2^32/Stride rounded up : CB offset to slot without division
+	int NumSamples;
+	int PlaySlot; // Ring slot of Played
+	int WriteSlot; // Ring slot of Written
+	uint64_t Played; // Slot being played
+	uint64_t Written; // Slots refilled
+} dmapos_t;
+
+// Stride : bytes of the CBs of one slot
+static inline void DmaPosInit(dmapos_t *Pos,uint32_t Base,uint32_t Stride,int NumSamples)
+{
+	Pos->Base=Base;
+	Pos->Reciprocal=(uint32_t)((0x100000000ULL+Stride-1)/Stride);
+	Pos->NumSamples=NumSamples;
+	Pos->PlaySlot=0;
+	Pos->WriteSlot=0;
+	Pos->Played=0;
+	Pos->Written=0;
+}
+
+// Ring slot of the CB at bus address Cb (exact while the offset is below 2^32/Stride)
+static inline int DmaPosSlot(const dmapos_t *Pos,uint32_t Cb)
+{
+	return (int)(((uint64_t)(Cb-Pos->Base)*Pos->Reciprocal)>>32);
+}
+
+// DMA is playing ring slot Slot, a slot outside the ring (end of chain, flag CB) is ignored
+static inline uint64_t DmaPosUpdate(dmapos_t *Pos,int Slot)
+{
+	int Delta=Slot-Pos->PlaySlot;
+	if((unsigned)Slot>=(unsigned)Pos->NumSamples) return Pos->Played;
+	if(Delta<0) Delta+=Pos->NumSamples;
+	Pos->PlaySlot=Slot;
+	Pos->Played+=Delta;
+	return Pos->Played;
+}
+
+// Count slots refilled from WriteSlot
+static inline void DmaPosWrite(dmapos_t *Pos,int Count)
+{
+	Pos->Written+=Count;
+	Pos->WriteSlot+=Count;
+	if(Pos->WriteSlot>=Pos->NumSamples) Pos->WriteSlot-=Pos->NumSamples;
+}
+
+// Slots refilled ahead of the DMA, the one being played included. <=0 : underrun,
+// the DMA plays slots of its previous lap
+static inline int DmaPosQueued(const dmapos_t *Pos)
+{
+	return (int)(int64_t)(Pos->Written-Pos->Played);
+}
+
+// After an underrun : refill from Ahead slots after the one being played
+static inline void DmaPosSkip(dmapos_t *Pos,int Ahead)
+{
+	Pos->Written=Pos->Played+Ahead;
+	Pos->WriteSlot=Pos->PlaySlot+Ahead;
+	while(Pos->WriteSlot>=Pos->NumSamples) Pos->WriteSlot-=Pos->NumSamples;
+}
+
+#endif
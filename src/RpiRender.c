@@ -0,0 +1,105 @@
+/*
+	Offline render of the control block stream
+
+	The file grows by RENDER_WINDOW and is written through a shared mapping,
+	so the encoder runs as fast as the CPU allows (no write() per burst).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "RpiRender.h"
+
+#define RENDER_WINDOW (16*1024*1024)
+#define RENDER_RECORD_MAX ((3+PWM_STEP_MAXI)*sizeof(uint32_t))
+
+static int RenderHandle=-1;
+static uint8_t *RenderMap=NULL; // Current window
+static off_t RenderMapOffset=0; // File offset of the window (page aligned)
+static size_t RenderMapPos=0; // Write position inside the window
+static long long RenderCount=0;
+static struct timespec RenderStart;
+
+static int RenderMapWindow(off_t FileOffset)
+{
+	off_t Aligned=FileOffset&~((off_t)PAGE_SIZE-1);
+
+	if(RenderMap!=NULL) munmap(RenderMap,RENDER_WINDOW);
+	RenderMap=NULL;
+	if(ftruncate(RenderHandle,Aligned+RENDER_WINDOW)!=0) return 0;
+	RenderMap=mmap(NULL,RENDER_WINDOW,PROT_READ|PROT_WRITE,MAP_SHARED,RenderHandle,Aligned);
+	if(RenderMap==MAP_FAILED)
+	{
+		RenderMap=NULL;
+		return 0;
+	}
+	RenderMapOffset=Aligned;
+	RenderMapPos=FileOffset-Aligned;
+	return 1;
+}
+
+int RenderOpen(const char *FileName)
+{
+	RenderHandle=open(FileName,O_RDWR|O_CREAT|O_TRUNC,0644);
+	if(RenderHandle<0) return 0;
+	if(!RenderMapWindow(0))
+	{
+		close(RenderHandle);
+		RenderHandle=-1;
+		return 0;
+	}
+	RenderCount=0;
+	clock_gettime(CLOCK_MONOTONIC,&RenderStart);
+	return 1;
+}
+
+void RenderSamples(struct control_data_s *ctl,int FirstSample,int Count,int NumSamples)
+{
+	int i;
+	int NoSample=FirstSample;
+
+	if(RenderMap==NULL) return;
+	for(i=0;i<Count;i++)
+	{
+		uint32_t Length=ctl->cb[NoSample*CBS_SIZE_BY_SAMPLE+2].length;
+		const sample_t *Slot=SampleSlot(ctl,NoSample);
+		uint32_t *Record;
+
+		if(RenderMapPos+RENDER_RECORD_MAX>RENDER_WINDOW)
+		{
+			if(!RenderMapWindow(RenderMapOffset+RenderMapPos))
+			{
+				printf("Render : failed to extend output file\n");
+				return;
+			}
+		}
+		Record=(uint32_t *)(RenderMap+RenderMapPos);
+		Record[0]=Length;
+		Record[1]=Slot->Amplitude1;
+		Record[2]=Slot->Amplitude2;
+		memcpy(Record+3,Slot->FrequencyTab,Length);
+		RenderMapPos+=3*sizeof(uint32_t)+Length;
+		if(++NoSample==NumSamples) NoSample=0;
+	}
+	RenderCount+=Count;
+}
+
+void RenderClose(void)
+{
+	struct timespec Now;
+	double Elapsed;
+	off_t Size=RenderMapOffset+RenderMapPos;
+
+	if(RenderHandle<0) return;
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	Elapsed=(Now.tv_sec-RenderStart.tv_sec)+(Now.tv_nsec-RenderStart.tv_nsec)/1e9;
+	if(RenderMap!=NULL) munmap(RenderMap,RENDER_WINDOW);
+	RenderMap=NULL;
+	if(ftruncate(RenderHandle,Size)!=0) printf("Render : failed to truncate output file\n");
+	close(RenderHandle);
+	RenderHandle=-1;
+	printf("Render : %lld samples %lld bytes in %.3fs : %.0f samples/s\n",RenderCount,(long long)Size,Elapsed,(Elapsed>0)?RenderCount/Elapsed:0);
+}
@@ -0,0 +1,17 @@
+#ifndef RPI_RENDER
+#define RPI_RENDER
+
+#include "RpiDma.h"
+
+// Offline render (rpitx --render out.bin) : every encoded sample is appended to a
+// memory mapped file instead of being played by DMA.
+// Record (uint32_t, host endianness) : Length (bytes of FrequencyTab given to the CB),
+// Amplitude1, Amplitude2, FrequencyTab[Length/4]
+
+int RenderOpen(const char *FileName);
+// Dump Count slots from FirstSample (wrap at NumSamples)
+void RenderSamples(struct control_data_s *ctl,int FirstSample,int Count,int NumSamples);
+// Flush the file and print samples/s, nothing if not rendering
+void RenderClose(void);
+
+#endif
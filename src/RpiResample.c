@@ -0,0 +1,151 @@
+/*
+	Polyphase rational resampler
+
+	Upsampled index m=n*L+p is computed from branch p only : y=sum(h[p+k*L]*x[n-k]).
+	The history is a linear buffer twice the filter length so the dot product
+	never wraps : it is copied down once every Taps inputs.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "RpiResample.h"
+
+#define KAISER_BETA 8.0
+#define CUTOFF_MARGIN 0.9 // Transition band starts at 90% of the lowest Nyquist
+
+static int Gcd(int a,int b)
+{
+	while(b!=0)
+	{
+		int t=a%b;
+		a=b;
+		b=t;
+	}
+	return a;
+}
+
+// Modified Bessel function of order 0 (Kaiser window)
+static double BesselI0(double x)
+{
+	double Sum=1.0,Term=1.0;
+	int k;
+	for(k=1;k<32;k++)
+	{
+		Term*=(x/(2.0*k))*(x/(2.0*k));
+		Sum+=Term;
+	}
+	return Sum;
+}
+
+int ResamplerInit(resampler_t *Rs,int InRate,int *OutRate)
+{
+	int g=Gcd(InRate,*OutRate);
+	int N,i,p,k;
+	double fc,Center;
+
+	memset(Rs,0,sizeof(resampler_t));
+	Rs->L=*OutRate/g;
+	Rs->M=InRate/g;
+	if(Rs->L>RESAMPLE_L_MAX)
+	{
+		// Closest ratio with L<=RESAMPLE_L_MAX
+		double Best=1e30;
+		int l;
+		for(l=1;l<=RESAMPLE_L_MAX;l++)
+		{
+			int m=(int)((double)InRate*l/(*OutRate)+0.5);
+			double Err;
+			if(m<1) continue;
+			Err=fabs((double)InRate*l/m-*OutRate);
+			if(Err<Best)
+			{
+				Best=Err;
+				Rs->L=l;
+				Rs->M=m;
+			}
+		}
+		g=Gcd(Rs->L,Rs->M);
+		Rs->L/=g;
+		Rs->M/=g;
+		*OutRate=(int)((double)InRate*Rs->L/Rs->M+0.5);
+	}
+	Rs->Taps=RESAMPLE_TAPS;
+	if(Rs->M>Rs->L) Rs->Taps=(RESAMPLE_TAPS*Rs->M+Rs->L-1)/Rs->L;
+	if(Rs->Taps>RESAMPLE_TAPS_MAX) Rs->Taps=RESAMPLE_TAPS_MAX;
+
+	Rs->Coef=malloc(Rs->L*Rs->Taps*sizeof(float));
+	Rs->History=calloc(4*Rs->Taps,sizeof(float));
+	if((Rs->Coef==NULL)||(Rs->History==NULL))
+	{
+		ResamplerFree(Rs);
+		return 0;
+	}
+
+	// Windowed sinc at the upsampled rate, gain L (zero stuffing)
+	N=Rs->L*Rs->Taps;
+	fc=CUTOFF_MARGIN*0.5/((Rs->L>Rs->M)?Rs->L:Rs->M);
+	Center=(N-1)/2.0;
+	for(p=0;p<Rs->L;p++)
+	{
+		for(k=0;k<Rs->Taps;k++)
+		{
+			double t,h,r;
+			i=p+k*Rs->L;
+			t=i-Center;
+			h=(t==0)?2.0*fc:sin(2.0*M_PI*fc*t)/(M_PI*t);
+			r=2.0*t/N;
+			h*=BesselI0(KAISER_BETA*sqrt((r*r<1.0)?1.0-r*r:0.0))/BesselI0(KAISER_BETA);
+			Rs->Coef[p*Rs->Taps+Rs->Taps-1-k]=h*Rs->L; // Reversed : oldest sample first
+		}
+	}
+	Rs->Pos=Rs->Taps;
+	Rs->Phase=0;
+	return 1;
+}
+
+void ResamplerFree(resampler_t *Rs)
+{
+	free(Rs->Coef);
+	free(Rs->History);
+	Rs->Coef=NULL;
+	Rs->History=NULL;
+}
+
+int ResamplerProcess(resampler_t *Rs,const float *In,int Count,float *Out)
+{
+	const int Taps=Rs->Taps;
+	float *History=Rs->History;
+	int NbOut=0;
+	int n;
+
+	for(n=0;n<Count;n++)
+	{
+		if(Rs->Pos==2*Taps)
+		{
+			memcpy(History,History+2*Taps,2*Taps*sizeof(float));
+			Rs->Pos=Taps;
+		}
+		History[2*Rs->Pos]=In[2*n];
+		History[2*Rs->Pos+1]=In[2*n+1];
+		Rs->Pos++;
+		while(Rs->Phase<Rs->L)
+		{
+			const float *Coef=Rs->Coef+Rs->Phase*Taps;
+			const float *Window=History+2*(Rs->Pos-Taps);
+			float I=0,Q=0;
+			int k;
+			for(k=0;k<Taps;k++)
+			{
+				I+=Coef[k]*Window[2*k];
+				Q+=Coef[k]*Window[2*k+1];
+			}
+			Out[2*NbOut]=I;
+			Out[2*NbOut+1]=Q;
+			NbOut++;
+			Rs->Phase+=Rs->M;
+		}
+		Rs->Phase-=Rs->L;
+	}
+	return NbOut;
+}
@@ -0,0 +1,33 @@
+#ifndef RPI_RESAMPLE
+#define RPI_RESAMPLE
+
+// Polyphase rational resampler for interleaved float I,Q : OutRate=InRate*L/M
+// Prototype is a Kaiser windowed sinc, cut at the lowest Nyquist of both rates.
+// Only the L polyphase branches are computed (no zero stuffing), one every M inputs.
+
+#define RESAMPLE_TAPS 24 // By branch when interpolating, scaled by M/L when decimating
+#define RESAMPLE_TAPS_MAX 256
+#define RESAMPLE_L_MAX 1024 // Bigger ratios are approximated (OutRate is rounded)
+
+typedef struct {
+	int L; // Interpolation
+	int M; // Decimation
+	int Taps; // Coefficients by branch
+	float *Coef; // [L][Taps], branch p is h[p+k*L], reversed for the dot product
+	float *History; // 2 x Taps complex : newest at the end, copied down when full
+	int Pos; // Next write in History (Taps..2*Taps-1)
+	int Phase; // Next output branch, >=L : wait for inputs
+} resampler_t;
+
+// 0 on allocation failure, OutRate may be rounded to keep L<=RESAMPLE_L_MAX
+int ResamplerInit(resampler_t *Rs,int InRate,int *OutRate);
+void ResamplerFree(resampler_t *Rs);
+// Outputs produced by Count input samples, at most
+static inline int ResamplerMaxOutput(const resampler_t *Rs,int Count)
+{
+	return (int)(((long long)Count*Rs->L+Rs->M-1)/Rs->M)+1;
+}
+// Push Count complex samples, return the number of complex samples written to Out
+int ResamplerProcess(resampler_t *Rs,const float *In,int Count,float *Out);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef RPI_RING
+#define RPI_RING
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// One DMA slot to encode : input/DSP thread -> refill thread
+typedef struct {
+	double Frequency; // Given to FrequencyAmplitudeToRegister (harmonic already applied)
+	uint32_t Amplitude; // 0..32767
+	uint32_t WaitNanoSecond; // Duration of this slot
+} txsample_t;
+
+// Lock-free single producer / single consumer ring, Size is a power of 2
+// Head and Tail are free running counters, each written by one side only
+typedef struct {
+	txsample_t *Sample;
+	uint32_t Mask;
+	uint32_t Head __attribute__((aligned(64))); // Producer
+	uint32_t Tail __attribute__((aligned(64))); // Consumer
+	int End __attribute__((aligned(64))); // Producer has no more input
+} txring_t;
+
+static inline int RingInit(txring_t *Ring,uint32_t MinSize)
+{
+	uint32_t Size=1;
+	while(Size<MinSize) Size<<=1;
+	Ring->Sample=malloc(Size*sizeof(txsample_t));
+	Ring->Mask=Size-1;
+	Ring->Head=0;
+	Ring->Tail=0;
+	Ring->End=0;
+	return Ring->Sample!=NULL;
+}
+
+static inline void RingFree(txring_t *Ring)
+{
+	free(Ring->Sample);
+	Ring->Sample=NULL;
+}
+
+// ---- Producer side
+static inline uint32_t RingSpace(txring_t *Ring)
+{
+	return Ring->Mask+1-(Ring->Head-__atomic_load_n(&Ring->Tail,__ATOMIC_ACQUIRE));
+}
+
+// i-th free slot after Head
+static inline txsample_t *RingWriteSlot(txring_t *Ring,uint32_t i)
+{
+	return &Ring->Sample[(Ring->Head+i)&Ring->Mask];
+}
+
+static inline void RingCommit(txring_t *Ring,uint32_t Count)
+{
+	__atomic_store_n(&Ring->Head,Ring->Head+Count,__ATOMIC_RELEASE);
+}
+
+static inline void RingSetEnd(txring_t *Ring)
+{
+	__atomic_store_n(&Ring->End,1,__ATOMIC_RELEASE);
+}
+
+// ---- Consumer side
+static inline uint32_t RingCount(txring_t *Ring)
+{
+	return __atomic_load_n(&Ring->Head,__ATOMIC_ACQUIRE)-Ring->Tail;
+}
+
+static inline const txsample_t *RingReadSlot(txring_t *Ring,uint32_t i)
+{
+	return &Ring->Sample[(Ring->Tail+i)&Ring->Mask];
+}
+
+static inline void RingRelease(txring_t *Ring,uint32_t Count)
+{
+	__atomic_store_n(&Ring->Tail,Ring->Tail+Count,__ATOMIC_RELEASE);
+}
+
+// Read End before RingCount : once End is seen, every committed sample is visible
+static inline int RingIsEnd(txring_t *Ring)
+{
+	return __atomic_load_n(&Ring->End,__ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+	Deadline based refill scheduler
+
+	The consumption rate is measured from the DMA CB position rather than
+	derived from SampleRate : RF/RFA slots have a variable duration.
+	The faster of the smoothed and last measured rates is used, so a rate
+	change wakes us up early rather than late.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include "RpiSched.h"
+
+#define SCHED_MIN_MEASURE 1000000LL // 1ms between rate measures
+#define SCHED_MAX_SLEEP 20000000LL // Never sleep more than 20ms (rate may change)
+
+int64_t SchedNow(void)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return Now.tv_sec*1000000000LL+Now.tv_nsec;
+}
+
+void SchedInit(refillsched_t *Sched,int NumSamples,int BurstSize,int FillPercent,double NominalRate)
+{
+	Sched->NumSamples=NumSamples;
+	Sched->FillTarget=(int)((long long)NumSamples*FillPercent/100);
+	// At least one burst must be free when we wake up
+	if(Sched->FillTarget>NumSamples-BurstSize) Sched->FillTarget=NumSamples-BurstSize;
+	if(Sched->FillTarget<0) Sched->FillTarget=0;
+	Sched->SlotPerNs=NominalRate/1e9;
+	Sched->LastSlotPerNs=Sched->SlotPerNs;
+	Sched->LastTime=SchedNow();
+	Sched->LastPlayed=0;
+	Sched->Wakeups=0;
+	Sched->LateSum=0;
+	Sched->LateMax=0;
+}
+
+void SchedStart(refillsched_t *Sched,uint64_t Played)
+{
+	Sched->LastTime=SchedNow();
+	Sched->LastPlayed=Played;
+}
+
+void SchedUpdate(refillsched_t *Sched,uint64_t Played)
+{
+	int64_t Now=SchedNow();
+	int64_t Elapsed=Now-Sched->LastTime;
+
+	if(Elapsed<SCHED_MIN_MEASURE) return;
+	Sched->LastSlotPerNs=(double)(Played-Sched->LastPlayed)/Elapsed;
+	Sched->SlotPerNs+=(Sched->LastSlotPerNs-Sched->SlotPerNs)/8;
+	Sched->LastTime=Now;
+	Sched->LastPlayed=Played;
+}
+
+int64_t SchedDeadline(refillsched_t *Sched,int Queued)
+{
+	double Rate=(Sched->LastSlotPerNs>Sched->SlotPerNs)?Sched->LastSlotPerNs:Sched->SlotPerNs;
+	int64_t Sleep;
+
+	if((Queued<=Sched->FillTarget)||(Rate<=0)) return SchedNow();
+	Sleep=(int64_t)((Queued-Sched->FillTarget)/Rate);
+	if(Sleep>SCHED_MAX_SLEEP) Sleep=SCHED_MAX_SLEEP;
+	return SchedNow()+Sleep;
+}
+
+void SchedSleepUntil(refillsched_t *Sched,int64_t Deadline)
+{
+	struct timespec Ts;
+	int64_t Late;
+
+	Ts.tv_sec=Deadline/1000000000LL;
+	Ts.tv_nsec=Deadline%1000000000LL;
+	while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&Ts,NULL)==EINTR);
+	Late=SchedNow()-Deadline;
+	Sched->Wakeups++;
+	Sched->LateSum+=Late;
+	if(Late>Sched->LateMax) Sched->LateMax=Late;
+}
+
+void SchedReport(refillsched_t *Sched)
+{
+	if(Sched->Wakeups==0) return;
+	printf("Refill : %llu wakeups, late mean %lldus max %lldus, %.0f slots/s, fill target %d/%d\n",
+		(unsigned long long)Sched->Wakeups,(long long)(Sched->LateSum/(int64_t)Sched->Wakeups/1000),(long long)(Sched->LateMax/1000),
+		Sched->SlotPerNs*1e9,Sched->FillTarget,Sched->NumSamples);
+}
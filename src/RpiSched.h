@@ -0,0 +1,35 @@
+#ifndef RPI_SCHED
+#define RPI_SCHED
+
+#include <stdint.h>
+
+// Refill scheduler : estimate how fast DMA consumes slots (from the CB position)
+// and sleep until the absolute CLOCK_MONOTONIC time the queue falls to FillTarget
+
+typedef struct {
+	int NumSamples; // Slots in the DMA ring
+	int FillTarget; // Wake up when this many slots are still queued
+	double SlotPerNs; // Smoothed consumption rate
+	double LastSlotPerNs; // Last measured rate
+	int64_t LastTime; // Time/position of the last rate measure
+	uint64_t LastPlayed;
+	// Wake-up jitter (actual - deadline)
+	uint64_t Wakeups;
+	int64_t LateSum;
+	int64_t LateMax;
+} refillsched_t;
+
+int64_t SchedNow(void); // CLOCK_MONOTONIC in ns
+// NominalRate in slots/s (first guess), FillPercent of NumSamples
+void SchedInit(refillsched_t *Sched,int NumSamples,int BurstSize,int FillPercent,double NominalRate);
+// DMA has just been started, Played : slots counted by the position tracker (RpiPos.h)
+void SchedStart(refillsched_t *Sched,uint64_t Played);
+// New DMA position
+void SchedUpdate(refillsched_t *Sched,uint64_t Played);
+// Absolute deadline for the next refill, Queued = slots not yet played
+int64_t SchedDeadline(refillsched_t *Sched,int Queued);
+// Sleep until Deadline (TIMER_ABSTIME) and account wake-up jitter
+void SchedSleepUntil(refillsched_t *Sched,int64_t Deadline);
+void SchedReport(refillsched_t *Sched);
+
+#endif
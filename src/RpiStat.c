@@ -0,0 +1,54 @@
+/*
+	Shared memory statistics page
+
+	Created by the transmitter (O_CREAT, 0644), only mapped read-only by
+	rpitx-stat : the reader never takes a lock the refill loop could wait on.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "RpiStat.h"
+
+static rpitx_stat_t StatPrivate; // No shared memory : counters are kept but not visible
+static char StatName[64];
+
+rpitx_stat_t *StatOpen(const char *Name)
+{
+	rpitx_stat_t *Stat=&StatPrivate;
+	int Handle=shm_open(Name,O_RDWR|O_CREAT|O_TRUNC,0644);
+
+	if(Handle>=0)
+	{
+		if(ftruncate(Handle,sizeof(rpitx_stat_t))==0)
+		{
+			void *Map=mmap(NULL,sizeof(rpitx_stat_t),PROT_READ|PROT_WRITE,MAP_SHARED,Handle,0);
+			if(Map!=MAP_FAILED)
+			{
+				Stat=Map;
+				snprintf(StatName,sizeof(StatName),"%s",Name);
+			}
+		}
+		close(Handle);
+	}
+	if(Stat==&StatPrivate)
+		printf("Warning : no shared memory statistics (%s)\n",Name);
+
+	memset(Stat,0,sizeof(rpitx_stat_t));
+	Stat->Version=RPITX_STAT_VERSION;
+	Stat->Pid=getpid();
+	Stat->StreamClients=-1;
+	__atomic_store_n(&Stat->Magic,RPITX_STAT_MAGIC,__ATOMIC_RELEASE);
+	return Stat;
+}
+
+void StatClose(rpitx_stat_t *Stat)
+{
+	if((Stat==NULL)||(Stat==&StatPrivate)) return;
+	munmap(Stat,sizeof(rpitx_stat_t));
+	shm_unlink(StatName);
+	StatName[0]=0;
+}
@@ -0,0 +1,75 @@
+#ifndef RPI_STAT
+#define RPI_STAT
+
+#include <stdint.h>
+
+// Runtime statistics in a POSIX shared memory page (read by rpitx-stat)
+// Each counter has only one writer (refill or input thread) : relaxed stores,
+// the reader may see counters of slightly different instants but never torn values
+
+#define RPITX_STAT_NAME "/rpitx-stat"
+#define RPITX_STAT_MAGIC 0x54535052 // "RPST"
+#define RPITX_STAT_VERSION 4
+#define STAT_HIST_BINS 16 // Refill time : bin i is [2^i,2^(i+1)[ us, bin 0 is <2us
+
+typedef struct {
+	uint32_t Magic;
+	uint32_t Version;
+	int32_t Pid;
+	int32_t Running; // 1 while pitx_run_ctx transmits
+	int32_t NumSamples;
+	int32_t BurstSize;
+	int32_t SampleRate;
+	int32_t MinHeadroom; // Min slots still queued in DMA at refill (0 = underrun)
+	uint64_t Runs; // pitx_run_ctx calls
+	uint64_t Bursts; // Bursts refilled
+	uint64_t RefillHist[STAT_HIST_BINS]; // Time to encode one burst
+	uint64_t Clips; // IQ overload (amplitude clipped)
+	uint64_t LoopRestarts; // Input rewound in loop mode
+	uint64_t ShortReads; // Input read returned less than asked
+	// Streaming input (--listen), StreamClients is -1 when not listening
+	int32_t StreamClients; // Connected producers
+	int32_t StreamLevel; // Bytes in the jitter buffer
+	int32_t StreamTarget; // Bytes buffered before (re)starting
+	int32_t StreamPriming; // 1 while waiting for StreamTarget
+	uint64_t StreamFrames;
+	uint64_t StreamBytes;
+	uint64_t StreamUnderruns; // Jitter buffer ran dry while transmitting
+	uint64_t SlotsReused; // Slots left as they were : same sample as one DMA lap before
+	uint64_t SlotsPlayed; // Counted by the DMA position tracker (RpiPos.h)
+	uint64_t DmaUnderruns; // DMA caught up with the refill and played slots of its previous lap
+} rpitx_stat_t;
+
+// Never NULL : a private page is used if shared memory is not available
+rpitx_stat_t *StatOpen(const char *Name);
+void StatClose(rpitx_stat_t *Stat);
+
+static inline void StatAdd(uint64_t *Counter,uint64_t Value)
+{
+	__atomic_store_n(Counter,*Counter+Value,__ATOMIC_RELAXED);
+}
+
+static inline void StatSet(int32_t *Value,int32_t NewValue)
+{
+	__atomic_store_n(Value,NewValue,__ATOMIC_RELAXED);
+}
+
+static inline void StatSet64(uint64_t *Value,uint64_t NewValue)
+{
+	__atomic_store_n(Value,NewValue,__ATOMIC_RELAXED);
+}
+
+static inline void StatRefillTime(rpitx_stat_t *Stat,int64_t Nanosecond)
+{
+	uint32_t Us=(uint32_t)(Nanosecond/1000);
+	int Bin=0;
+	while((Us>>=1)&&(Bin<STAT_HIST_BINS-1)) Bin++;
+	StatAdd(&Stat->RefillHist[Bin],1);
+}
+
+static inline void StatHeadroom(rpitx_stat_t *Stat,int32_t Queued)
+{
+	if(Queued<Stat->MinHeadroom) StatSet(&Stat->MinHeadroom,Queued);
+}
+
+#endif
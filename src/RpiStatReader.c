@@ -0,0 +1,102 @@
+/*
+	rpitx-stat : live view of the rpitx statistics page
+
+	rpitx-stat [-n] [-i seconds] [name]
+	Maps the page read-only, rpitx is never slowed down or locked.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "RpiStat.h"
+
+static void print_stat(const volatile rpitx_stat_t *Stat,const rpitx_stat_t *Last,int Interval)
+{
+	int i;
+	uint64_t Total=0;
+
+	printf("pid %d %s : %d slots, burst %d, samplerate %d, run %llu\n",Stat->Pid,Stat->Running?"running":"stopped",
+		Stat->NumSamples,Stat->BurstSize,Stat->SampleRate,(unsigned long long)Stat->Runs);
+	printf("bursts %llu",(unsigned long long)Stat->Bursts);
+	if(Interval>0) printf(" (%llu/s)",(unsigned long long)(Stat->Bursts-Last->Bursts)/Interval);
+	printf(" min headroom %d slots\n",Stat->MinHeadroom);
+	printf("clips %llu loop restarts %llu short reads %llu\n",(unsigned long long)Stat->Clips,
+		(unsigned long long)Stat->LoopRestarts,(unsigned long long)Stat->ShortReads);
+	printf("slots reused %llu of %llu\n",(unsigned long long)Stat->SlotsReused,
+		(unsigned long long)Stat->Bursts*Stat->BurstSize);
+	printf("slots played %llu",(unsigned long long)Stat->SlotsPlayed);
+	if(Interval>0) printf(" (%llu/s)",(unsigned long long)(Stat->SlotsPlayed-Last->SlotsPlayed)/Interval);
+	printf(" dma underruns %llu\n",(unsigned long long)Stat->DmaUnderruns);
+	if(Stat->StreamClients>=0)
+	{
+		printf("stream : %d producers, buffer %d/%d bytes%s, frames %llu bytes %llu",Stat->StreamClients,
+			Stat->StreamLevel,Stat->StreamTarget,Stat->StreamPriming?" (buffering)":"",
+			(unsigned long long)Stat->StreamFrames,(unsigned long long)Stat->StreamBytes);
+		if(Interval>0) printf(" (%llu/s)",(unsigned long long)(Stat->StreamBytes-Last->StreamBytes)/Interval);
+		printf(" underruns %llu\n",(unsigned long long)Stat->StreamUnderruns);
+	}
+	for(i=0;i<STAT_HIST_BINS;i++) Total+=Stat->RefillHist[i];
+	printf("refill time :");
+	for(i=0;i<STAT_HIST_BINS;i++)
+	{
+		if(Stat->RefillHist[i]==0) continue;
+		printf(" <%dus:%.1f%%",2<<i,100.0*Stat->RefillHist[i]/Total);
+	}
+	printf("\n\n");
+}
+
+int main(int argc,char *argv[])
+{
+	const char *Name=RPITX_STAT_NAME;
+	int Once=0;
+	int Interval=1;
+	int a;
+	int Handle;
+	const volatile rpitx_stat_t *Stat;
+	rpitx_stat_t Last;
+
+	while((a=getopt(argc,argv,"ni:h"))!=-1)
+	{
+		switch(a)
+		{
+		case 'n': // Print once
+			Once=1;
+			break;
+		case 'i': // Refresh interval
+			Interval=atoi(optarg);
+			if(Interval<1) Interval=1;
+			break;
+		default:
+			fprintf(stderr,"Usage : rpitx-stat [-n print once] [-i seconds] [name (default %s)]\n",RPITX_STAT_NAME);
+			exit(1);
+		}
+	}
+	if(optind<argc) Name=argv[optind];
+
+	Handle=shm_open(Name,O_RDONLY,0);
+	if(Handle<0)
+	{
+		fprintf(stderr,"rpitx-stat : %s not found, is rpitx running ?\n",Name);
+		exit(1);
+	}
+	Stat=mmap(NULL,sizeof(rpitx_stat_t),PROT_READ,MAP_SHARED,Handle,0);
+	close(Handle);
+	if((Stat==MAP_FAILED)||(Stat->Magic!=RPITX_STAT_MAGIC)||(Stat->Version!=RPITX_STAT_VERSION))
+	{
+		fprintf(stderr,"rpitx-stat : %s is not a rpitx statistics page\n",Name);
+		exit(1);
+	}
+
+	memcpy(&Last,(const void *)Stat,sizeof(Last));
+	for(;;)
+	{
+		if(!Once) sleep(Interval);
+		print_stat(Stat,&Last,Once?0:Interval);
+		if(Once) break;
+		memcpy(&Last,(const void *)Stat,sizeof(Last));
+	}
+	return 0;
+}
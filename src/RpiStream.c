@@ -0,0 +1,313 @@
+/*
+	Streaming input server
+
+	The ingest thread never blocks on a producer : sockets are non blocking and only
+	polled. A complete frame is queued at once; while the jitter buffer has no room
+	for it the client is not read any more (TCP flow control slows the producer)
+	and the thread polls again every STREAM_RETRY_MS.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "RpiStream.h"
+
+#define STREAM_RETRY_MS 5
+
+static void SetNonBlocking(int Handle)
+{
+	fcntl(Handle,F_SETFL,fcntl(Handle,F_GETFL)|O_NONBLOCK);
+}
+
+static int StreamListen(streaminput_t *Stream,const char *Address)
+{
+	int Handle;
+
+	if(strncmp(Address,"unix:",5)==0)
+	{
+		struct sockaddr_un Addr;
+		memset(&Addr,0,sizeof(Addr));
+		Addr.sun_family=AF_UNIX;
+		if(strlen(Address+5)>=sizeof(Addr.sun_path)) return -1;
+		strcpy(Addr.sun_path,Address+5);
+		Handle=socket(AF_UNIX,SOCK_STREAM,0);
+		if(Handle<0) return -1;
+		unlink(Addr.sun_path);
+		if(bind(Handle,(struct sockaddr *)&Addr,sizeof(Addr))!=0)
+		{
+			close(Handle);
+			return -1;
+		}
+		Stream->UnixPath=strdup(Addr.sun_path);
+	}
+	else if(strncmp(Address,"tcp:",4)==0)
+	{
+		struct sockaddr_in Addr;
+		int One=1;
+		memset(&Addr,0,sizeof(Addr));
+		Addr.sin_family=AF_INET;
+		Addr.sin_port=htons(atoi(Address+4));
+		Addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK); // Local producers only
+		Handle=socket(AF_INET,SOCK_STREAM,0);
+		if(Handle<0) return -1;
+		setsockopt(Handle,SOL_SOCKET,SO_REUSEADDR,&One,sizeof(One));
+		if(bind(Handle,(struct sockaddr *)&Addr,sizeof(Addr))!=0)
+		{
+			close(Handle);
+			return -1;
+		}
+	}
+	else return -1;
+
+	if(listen(Handle,STREAM_CLIENT_MAX)!=0)
+	{
+		close(Handle);
+		return -1;
+	}
+	SetNonBlocking(Handle);
+	return Handle;
+}
+
+static void StreamAccept(streaminput_t *Stream)
+{
+	int Handle;
+	int i;
+
+	while((Handle=accept(Stream->Listen,NULL,NULL))>=0)
+	{
+		for(i=0;i<STREAM_CLIENT_MAX;i++)
+			if(Stream->Client[i]==NULL) break;
+		if(i==STREAM_CLIENT_MAX)
+		{
+			printf("Stream : too many producers, connection refused\n");
+			close(Handle);
+			continue;
+		}
+		Stream->Client[i]=calloc(1,sizeof(streamclient_t));
+		if(Stream->Client[i]==NULL)
+		{
+			close(Handle);
+			continue;
+		}
+		SetNonBlocking(Handle);
+		Stream->Client[i]->Handle=Handle;
+		__atomic_store_n(&Stream->Clients,Stream->Clients+1,__ATOMIC_RELAXED);
+	}
+}
+
+static void StreamDrop(streaminput_t *Stream,int i)
+{
+	close(Stream->Client[i]->Handle);
+	free(Stream->Client[i]);
+	Stream->Client[i]=NULL;
+	__atomic_store_n(&Stream->Clients,Stream->Clients-1,__ATOMIC_RELAXED);
+}
+
+// Queue the complete frame of Client, 0 if the jitter buffer has no room yet
+static int StreamQueue(streaminput_t *Stream,streamclient_t *Client)
+{
+	uint32_t Length=Client->Header.Length;
+	uint32_t Size=Stream->Mask+1;
+	uint32_t Head=Stream->Head;
+	uint32_t Offset=Head&Stream->Mask;
+	uint32_t First=(Length<Size-Offset)?Length:Size-Offset;
+
+	if(Length==0)
+	{
+		__atomic_store_n(&Stream->End,1,__ATOMIC_RELEASE);
+		return 1;
+	}
+	if(Size-(Head-__atomic_load_n(&Stream->Tail,__ATOMIC_ACQUIRE))<Length) return 0;
+	memcpy(Stream->Buffer+Offset,Client->Payload,First);
+	memcpy(Stream->Buffer,Client->Payload+First,Length-First);
+	__atomic_store_n(&Stream->Head,Head+Length,__ATOMIC_RELEASE);
+	__atomic_store_n(&Stream->Frames,Stream->Frames+1,__ATOMIC_RELAXED);
+	__atomic_store_n(&Stream->Bytes,Stream->Bytes+Length,__ATOMIC_RELAXED);
+	return 1;
+}
+
+// Read what is available, return 0 to drop the client
+static int StreamReceive(streaminput_t *Stream,streamclient_t *Client)
+{
+	for(;;)
+	{
+		size_t Want;
+		ssize_t NbRead;
+		uint8_t *Dest;
+
+		if(Client->Got<sizeof(streamframe_t))
+		{
+			Dest=(uint8_t *)&Client->Header+Client->Got;
+			Want=sizeof(streamframe_t)-Client->Got;
+		}
+		else
+		{
+			Dest=Client->Payload+Client->Got-sizeof(streamframe_t);
+			Want=sizeof(streamframe_t)+Client->Header.Length-Client->Got;
+		}
+		if(Want==0) return 1; // Frame complete, waiting for room
+		NbRead=read(Client->Handle,Dest,Want);
+		if(NbRead==0) return 0; // Producer gone
+		if(NbRead<0) return (errno==EAGAIN)||(errno==EWOULDBLOCK)||(errno==EINTR);
+		Client->Got+=NbRead;
+		if(Client->Got==sizeof(streamframe_t))
+		{
+			if((Client->Header.Magic!=STREAM_MAGIC)||(Client->Header.Length>STREAM_FRAME_MAX)||(Client->Header.Length%Stream->RecordSize!=0))
+			{
+				printf("Stream : bad frame header, producer dropped\n");
+				return 0;
+			}
+		}
+		if((Client->Got>=sizeof(streamframe_t))&&(Client->Got==sizeof(streamframe_t)+Client->Header.Length))
+		{
+			if(!StreamQueue(Stream,Client)) return 1;
+			Client->Got=0;
+		}
+	}
+}
+
+static void *StreamThread(void *arg)
+{
+	streaminput_t *Stream=(streaminput_t *)arg;
+	struct pollfd Fd[STREAM_CLIENT_MAX+2];
+	int Index[STREAM_CLIENT_MAX+2];
+
+	while(!__atomic_load_n(&Stream->Stop,__ATOMIC_ACQUIRE))
+	{
+		int Nb=0;
+		int Waiting=0;
+		int i,k;
+		char Dummy;
+
+		Fd[Nb].fd=Stream->Pipe[0];
+		Fd[Nb++].events=POLLIN;
+		Fd[Nb].fd=Stream->Listen;
+		Fd[Nb++].events=POLLIN;
+		for(i=0;i<STREAM_CLIENT_MAX;i++)
+		{
+			streamclient_t *Client=Stream->Client[i];
+			if(Client==NULL) continue;
+			// Complete frame waiting for room : retry it, don't read further
+			if((Client->Got>=sizeof(streamframe_t))&&(Client->Got==sizeof(streamframe_t)+Client->Header.Length))
+			{
+				if(StreamQueue(Stream,Client))
+					Client->Got=0;
+				else
+				{
+					Waiting=1;
+					continue;
+				}
+			}
+			Index[Nb]=i;
+			Fd[Nb].fd=Client->Handle;
+			Fd[Nb++].events=POLLIN;
+		}
+		if(poll(Fd,Nb,Waiting?STREAM_RETRY_MS:-1)<=0) continue;
+		if(Fd[0].revents) while(read(Stream->Pipe[0],&Dummy,1)>0);
+		if(Fd[1].revents) StreamAccept(Stream);
+		for(k=2;k<Nb;k++)
+		{
+			if(Fd[k].revents==0) continue;
+			if(!StreamReceive(Stream,Stream->Client[Index[k]]))
+				StreamDrop(Stream,Index[k]);
+		}
+	}
+	return NULL;
+}
+
+streaminput_t *StreamOpen(const char *Address,size_t RecordSize,size_t JitterBytes,int Underrun)
+{
+	streaminput_t *Stream=calloc(1,sizeof(streaminput_t));
+	uint32_t Size=1;
+	sigset_t All,Old;
+
+	if(Stream==NULL) return NULL;
+	Stream->RecordSize=RecordSize;
+	Stream->Target=JitterBytes-JitterBytes%RecordSize;
+	Stream->Priming=1;
+	Stream->Underrun=Underrun;
+	// Room for the target plus frames still arriving
+	while((Size<4*Stream->Target)||(Size<4*STREAM_FRAME_MAX)) Size<<=1;
+	Stream->Buffer=malloc(Size);
+	Stream->Mask=Size-1;
+	Stream->Listen=StreamListen(Stream,Address);
+	if((Stream->Buffer==NULL)||(Stream->Listen<0)||(pipe(Stream->Pipe)!=0))
+	{
+		if(Stream->Listen>=0) close(Stream->Listen);
+		free(Stream->UnixPath);
+		free(Stream->Buffer);
+		free(Stream);
+		return NULL;
+	}
+	SetNonBlocking(Stream->Pipe[0]);
+	// Signals (terminate) are handled by the transmitter threads
+	sigfillset(&All);
+	pthread_sigmask(SIG_BLOCK,&All,&Old);
+	if(pthread_create(&Stream->Thread,NULL,StreamThread,Stream)!=0) Stream->Stop=1;
+	pthread_sigmask(SIG_SETMASK,&Old,NULL);
+	if(Stream->Stop)
+	{
+		StreamClose(Stream);
+		return NULL;
+	}
+	return Stream;
+}
+
+void StreamClose(streaminput_t *Stream)
+{
+	int i;
+
+	if(!Stream->Stop)
+	{
+		__atomic_store_n(&Stream->Stop,1,__ATOMIC_RELEASE);
+		if(write(Stream->Pipe[1],"",1)!=1) printf("Stream : failed to wake up ingest thread\n");
+		pthread_join(Stream->Thread,NULL);
+	}
+	for(i=0;i<STREAM_CLIENT_MAX;i++)
+		if(Stream->Client[i]!=NULL) StreamDrop(Stream,i);
+	close(Stream->Listen);
+	close(Stream->Pipe[0]);
+	close(Stream->Pipe[1]);
+	if(Stream->UnixPath!=NULL) unlink(Stream->UnixPath);
+	free(Stream->UnixPath);
+	free(Stream->Buffer);
+	free(Stream);
+}
+
+int StreamRead(streaminput_t *Stream,void *Dest,size_t Count)
+{
+	// End before Level : once End is seen, every queued frame is visible
+	int End=__atomic_load_n(&Stream->End,__ATOMIC_ACQUIRE);
+	uint32_t Level=__atomic_load_n(&Stream->Head,__ATOMIC_ACQUIRE)-Stream->Tail;
+	uint32_t Offset=Stream->Tail&Stream->Mask;
+	uint32_t First=(Count<Stream->Mask+1-Offset)?Count:Stream->Mask+1-Offset;
+
+	if(Level<Count)
+	{
+		if(End) return STREAM_END;
+		if(!Stream->Priming)
+		{
+			Stream->Priming=1;
+			__atomic_store_n(&Stream->Underruns,Stream->Underruns+1,__ATOMIC_RELAXED);
+		}
+		return STREAM_UNDERRUN;
+	}
+	if(Stream->Priming)
+	{
+		if((Level<Stream->Target)&&(!End)) return STREAM_UNDERRUN;
+		Stream->Priming=0;
+	}
+	memcpy(Dest,Stream->Buffer+Offset,First);
+	memcpy((uint8_t *)Dest+First,Stream->Buffer,Count-First);
+	__atomic_store_n(&Stream->Tail,Stream->Tail+Count,__ATOMIC_RELEASE);
+	return STREAM_DATA;
+}
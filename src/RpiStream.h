@@ -0,0 +1,82 @@
+#ifndef RPI_STREAM
+#define RPI_STREAM
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Streaming input server (rpitx --listen) : local producers connect to a Unix socket
+// or to 127.0.0.1:port and send frames of records in the format of the mode
+// (IQ : int16 I/Q, IQFLOAT : float I/Q, RF : samplerf_t).
+// Frame : streamframe_t header (host endianness) then Length bytes of whole records.
+// Length 0 ends the transmission. Several producers may be connected, frames are
+// queued whole in arrival order.
+//
+// An ingest thread polls the sockets (non blocking) and queues frames in a jitter buffer.
+// The input thread only starts consuming once Target bytes are buffered, and again
+// after an underrun.
+
+#define STREAM_MAGIC 0x58545052 // "RPTX"
+#define STREAM_FRAME_MAX (64*1024)
+#define STREAM_CLIENT_MAX 8
+
+typedef struct {
+	uint32_t Magic;
+	uint32_t Length; // Bytes of records following the header
+} streamframe_t;
+
+#define STREAM_DATA 0
+#define STREAM_UNDERRUN 1 // Not enough buffered : send the underrun fill instead
+#define STREAM_END 2 // End frame received and everything consumed
+
+#define UNDERRUN_OFF 0 // Carrier off (amplitude 0)
+#define UNDERRUN_HOLD 1 // Repeat the last sample
+
+typedef struct {
+	int Handle; // Non blocking
+	size_t Got; // Bytes of the current frame (header included)
+	streamframe_t Header;
+	uint8_t Payload[STREAM_FRAME_MAX];
+} streamclient_t;
+
+typedef struct {
+	int Listen;
+	char *UnixPath; // Unlinked on close
+	size_t RecordSize;
+	int Pipe[2]; // Wakes up the ingest thread (space in the buffer, close)
+	pthread_t Thread;
+	streamclient_t *Client[STREAM_CLIENT_MAX];
+
+	// Jitter buffer : byte ring, single producer (ingest) / single consumer (input thread)
+	uint8_t *Buffer;
+	uint32_t Mask;
+	uint32_t Head __attribute__((aligned(64))); // Ingest
+	uint32_t Tail __attribute__((aligned(64))); // Input thread
+	int End;
+	int Stop;
+	uint32_t Target; // Bytes buffered before (re)starting
+	int Priming; // Input thread : waiting for Target
+	int Underrun; // UNDERRUN_OFF or UNDERRUN_HOLD
+
+	// Counters, one writer each
+	uint64_t Frames; // Ingest
+	uint64_t Bytes; // Ingest
+	int32_t Clients; // Ingest
+	uint64_t Underruns; // Input thread
+} streaminput_t;
+
+// Address : unix:PATH or tcp:PORT (bound to 127.0.0.1)
+// JitterBytes : bytes buffered before starting (rounded to whole records)
+streaminput_t *StreamOpen(const char *Address,size_t RecordSize,size_t JitterBytes,int Underrun);
+void StreamClose(streaminput_t *Stream);
+
+// Input thread : copy Count bytes (whole records) to Dest
+int StreamRead(streaminput_t *Stream,void *Dest,size_t Count);
+
+// Bytes queued in the jitter buffer
+static inline uint32_t StreamLevel(streaminput_t *Stream)
+{
+	return __atomic_load_n(&Stream->Head,__ATOMIC_ACQUIRE)-__atomic_load_n(&Stream->Tail,__ATOMIC_ACQUIRE);
+}
+
+#endif
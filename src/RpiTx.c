@@ -50,9 +50,17 @@ Optimize CPU on PWMFrequency
 #include <termios.h>		//Used for UART
 #include "RpiGpio.h"
 #include "RpiDma.h"
+#include "RpiBackend.h"
 #include <pthread.h>
 
 #include "RpiTx.h"
+#include "RpiIQ.h"
+#include "RpiRender.h"
+#include "RpiRing.h"
+#include "RpiSched.h"
+#include "RpiPos.h"
+#include "RpiResample.h"
+#include "RpiFt.h"
 
 #include <sys/prctl.h>
 #include <getopt.h>
@@ -60,8 +68,14 @@ Optimize CPU on PWMFrequency
 
 #define AMP_BYPAD
 
-//Minimum Time in us to sleep
-#define KERNEL_GRANULARITY 20000 
+#define PWM_DITHER_SEED 0x2545F491 // Any non zero value
+#define VFO_AMPLITUDE 32767 //To be fine tuned !!!!	
+#define VFO_SAMPLE_NS 25000
+
+//Wait for the input thread (ns)
+#define REFILL_POLL_NS 500000
+//Timed start : the end of the wait is a busy loop (wake-up latency of the sleep)
+#define START_SPIN_NS 300000
 
 #define SCHED_PRIORITY 30 //Linux scheduler priority. Higher = more realtime
 
@@ -85,36 +99,22 @@ Optimize CPU on PWMFrequency
 
 // DMA TIMING : depends on Pi Model : Calibration is better
 #define FREQ_DELAY_TIME 0
-int FREQ_MINI_TIMING=157;
-int PWMF_MARGIN = 1120; //A Margin for now at 1us with PCM ->OK
-int globalppmpll=0;
+#define DEFAULT_FREQ_MINI_TIMING 157
+#define DEFAULT_PWMF_MARGIN 1120 //A Margin for now at 1us with PCM ->OK
+#define CALIB_ROUNDS 10 // GetDMADelay rounds of a full calibration, the cache check does 1
+#define CALIB_TABLE_ROUNDS 3 // By step count of the timing table (--calib full)
+#define CALIB_CHECK_PERCENT 5 // Cache entry used if the check is this close to it
+#define CALIB_REFRESH_AGE (7*24*3600) // Older cache entries are measured again after the run
+#define MAX_DELAY_WAIT (PWM_STEP_MAXI/2*ctx->FREQ_MINI_TIMING-ctx->PWMF_MARGIN) // RF records are split in samples of this time
 
 typedef unsigned char 	uchar;      // 8 bit
 typedef unsigned short	uint16;     // 16 bit
 typedef unsigned int	uint;       // 32 bits
 
-//F5OEO Variable
-uint32_t PllFreq500MHZ;
-uint32_t PllFreq1GHZ;
-uint32_t PllFreq19MHZ;
-
-uint32_t PllUsed;
-char PllNumber;
-double TuneFrequency=62500000;
-unsigned char FreqDivider=2;
-int DmaSampleBurstSize=1000;
-int NUM_SAMPLES=NUM_SAMPLES_MAX;
-int Randomize=0;
-
-uint32_t GlobalTabPwmFrequency[50];
-
-//End F5OEO
-
-char EndOfApp=0;
-unsigned char loop_mode_flag=0;
 char *FileName = 0;
 int FileInHandle = -1; //Handle in Transport Stream File
-int useStdin = 0;
+
+static pitx_ctx *SignalCtx=NULL; // Context owning the peripherals and DMA arena, stopped by terminate (signals are per process)
 
 static void udelay(int us)
 {
@@ -123,13 +123,9 @@ static void udelay(int us)
 	nanosleep(&ts, NULL);
 }
 
-static void stop_dma(void)
+static void stop_dma(pitx_ctx *ctx)
 {
 	
-	if (FileInHandle != -1) {
-		close(FileInHandle);
-		FileInHandle = -1;
-	}
 	if (dma_reg) {
 		//Stop Main DMA
 		//STop DMA
@@ -155,19 +151,15 @@ static void stop_dma(void)
 		udelay(100);
 		//printf("Reset pwm Done\n");
 	}
-	if (mbox.virt_addr != NULL) {
-		unmapmem(mbox.virt_addr, NUM_PAGES * PAGE_SIZE);
-		//printf("Unmapmem Done\n");
-		mem_unlock(mbox.handle, mbox.mem_ref);
-		//printf("Unmaplock Done\n");
-		mem_free(mbox.handle, mbox.mem_ref);
-		//printf("Unmapfree Done\n");
-	}
+	if(ctx!=NULL) SchedReport(&ctx->RefillSched);
+	RenderClose();
 }
 
 static void terminate(int dummy)
 {
-	stop_dma();
+	stop_dma(SignalCtx);
+	Backend->Release();
+	if(SignalCtx!=NULL) StatClose(SignalCtx->Stat);
 	//munmap(virtbase,NUM_PAGES * PAGE_SIZE); 
 	printf("END OF PiTx\n");
 	exit(1);
@@ -197,16 +189,21 @@ void setSchedPriority(int priority)
 
 }
 
-uint32_t DelayFromSampleRate=0;
-int Instrumentation=0;
-int UsePCMClk=0;
-uint32_t Originfsel=0;
+// RF pin to the PWM (GPIO18 ALT5) or the clock (GPIO4 ALT0), or input : no carrier while
+// calibrating and priming. In clock mode the DMA then sets GPFSEL0 for every slot (Amplitude2)
+static void RfOutput(pitx_ctx *ctx,int On)
+{
+	if(ctx->UsePCMClk==0)
+		gpioSetMode(18,On?2:0);
+	else
+		gpioSetMode(4,On?4:0);
+}
 
-int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
+int SetupGpioClock(pitx_ctx *ctx,uint32_t SymbolRate,double TuningFrequency)
 {
 	char MASH=1;
 	 	
-	if(UsePCMClk==0) TuningFrequency=TuningFrequency*2;	
+	if(ctx->UsePCMClk==0) TuningFrequency=TuningFrequency*2;	
 	if((TuningFrequency>=100e6)&&(TuningFrequency<=150e6))
 	{
 		MASH=2;
@@ -216,10 +213,9 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 		MASH=3;
 	}
 	
-	printf("MASH %d Freq PLL# %d\n",MASH,PllNumber);
-	Originfsel=gpio_reg[GPFSEL0]; // Warning carefull if FSEL is used after !!!!!!!!!!!!!!!!!!!!
-	if(UsePCMClk==1)
-			gpio_reg[GPFSEL0] = (Originfsel & ~(7 << 12)) | (4 << 12); //ENABLE CLOCK ON GPIO CLK
+	printf("MASH %d Freq PLL# %d\n",MASH,ctx->PllNumber);
+	ctx->Originfsel=gpio_reg[GPFSEL0]; // Warning carefull if FSEL is used after !!!!!!!!!!!!!!!!!!!!
+	RfOutput(ctx,0); // Clock runs from now : pin is connected when the DMA starts
 
 		
 	// ------------------- MAKE MAX OUTPUT CURRENT FOR GPIO -----------------------
@@ -236,8 +232,8 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 	static uint32_t FreqFractionnalPCM;
 	int NbStepPCM = 25; // Should not exceed 1000 : 
 	
-	FreqDividerPCM=(int) ((double)PllFreq1GHZ/(SymbolRate*NbStepPCM/**PwmNumberStep*/));
-	FreqFractionnalPCM=4096.0 * (((double)PllFreq1GHZ/(SymbolRate*NbStepPCM/**PwmNumberStep*/))-FreqDividerPCM);
+	FreqDividerPCM=(int) ((double)ctx->PllFreq1GHZ/(SymbolRate*NbStepPCM/**PwmNumberStep*/));
+	FreqFractionnalPCM=4096.0 * (((double)ctx->PllFreq1GHZ/(SymbolRate*NbStepPCM/**PwmNumberStep*/))-FreqDividerPCM);
 	
 	printf("SampleRate=%d\n",SymbolRate);
 	if((FreqDividerPCM>4096)||(FreqDividerPCM<2)) printf("Warning : SampleRate is not valid\n"); 
@@ -245,7 +241,7 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 	udelay(1000);
 	//printf("Div PCM %d FracPCM %d\n",FreqDividerPCM,FreqFractionnalPCM);
 	
-	 DelayFromSampleRate=(1e9/(SymbolRate));
+	uint32_t DelayFromSampleRate=(1e9/(SymbolRate));
 			
 	pcm_reg[PCM_TXC_A] = 0<<31 | 1<<30 | 0<<20 | 0<<16; // 1 channel, 8 bits
 	udelay(100);
@@ -266,16 +262,14 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 	// FIN PCM
 
 	//INIT PWM in Serial Mode : WE USE PWM OUPUT
-	if(UsePCMClk==0)
+	if(ctx->UsePCMClk==0)
 	{
-		gpioSetMode(18, 2); /* set to ALT5, PWM1 : RF On PIN */	
-
 		pwm_reg[PWM_CTL] = 0;
-		clk_reg[PWMCLK_CNTL] = 0x5A000000 | (MASH << 9) |PllNumber/*PLL_1GHZ*/ ;
+		clk_reg[PWMCLK_CNTL] = 0x5A000000 | (MASH << 9) |ctx->PllNumber/*PLL_1GHZ*/ ;
 		udelay(300);
 		clk_reg[PWMCLK_DIV] = 0x5A000000 | (2<<12); //WILL BE UPDATED BY DMA
 		udelay(300);
-		clk_reg[PWMCLK_CNTL] = 0x5A000010 | (MASH << 9) | PllNumber /*PLL_1GHZ*/; //MASH3 : A TESTER SI MIEUX en MASH1
+		clk_reg[PWMCLK_CNTL] = 0x5A000010 | (MASH << 9) | ctx->PllNumber /*PLL_1GHZ*/; //MASH3 : A TESTER SI MIEUX en MASH1
 		//MASH 3 doesnt seem work above 80MHZ, back to MASH1
 		pwm_reg[PWM_RNG1] = 32;// 250 -> 8KHZ
 		udelay(100);
@@ -291,17 +285,49 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 	// FIN INIT PWM
 
 	//******************* INIT CLK MODE : WE OUTPUT CLK INSTEAD OF PWM OUTPUT
-	if(UsePCMClk==1)
+	if(ctx->UsePCMClk==1)
 	{
-		clk_reg[GPCLK_CNTL] = 0x5A000000 | (MASH << 9) |PllNumber/*PLL_1GHZ*/ ;
+		clk_reg[GPCLK_CNTL] = 0x5A000000 | (MASH << 9) |ctx->PllNumber/*PLL_1GHZ*/ ;
 		udelay(300);
 		clk_reg[GPCLK_DIV] = 0x5A000000 | (2<<12); //WILL BE UPDATED BY DMA !! CAREFUL NOT DIVIDE BY 2 LIKE PWM
 		udelay(300);
-		clk_reg[GPCLK_CNTL] = 0x5A000010 | (MASH << 9) | PllNumber /*PLL_1GHZ*/; //MASH3 : A TESTER SI MIEUX en MASH1
+		clk_reg[GPCLK_CNTL] = 0x5A000010 | (MASH << 9) | ctx->PllNumber /*PLL_1GHZ*/; //MASH3 : A TESTER SI MIEUX en MASH1
 	}
 
 
+	return 1;
+}
+
+// Lay out the DMA arena for slots of NbStep FrequencyTab words and chain the control blocks,
+// with a completion flag CB after each burst if Handoff (ring of whole bursts).
+// The arena is allocated again when its size changes (DMA stopped : start of run, calibration)
+static void SetupDmaArena(pitx_ctx *ctx,int NbStep,int Handoff)
+{
+	int Words=2+((NbStep+1)&~1); // Amplitude1,Amplitude2,FrequencyTab : 8 bytes aligned
+	int Bursts=Handoff?ctx->NUM_SAMPLES/ctx->DmaSampleBurstSize:0;
+	size_t SlotsSize=(size_t)ctx->NUM_SAMPLES*Words*sizeof(uint32_t);
+	// GetDMADelay reads up to PWM_STEP_MAXI words from the last slot (timing table)
+	size_t HandoffOffset=(sizeof(struct control_data_s)+SlotsSize+PWM_STEP_MAXI*sizeof(uint32_t)+31)&~(size_t)31;
+	size_t Size=HandoffOffset+Bursts*(sizeof(dma_cb_t)+sizeof(uint32_t))+sizeof(uint32_t);
+
+	Size=(Size+PAGE_SIZE-1)&~(size_t)(PAGE_SIZE-1);
+	if(Size!=mbox.size)
+	{
+		Backend->FreeArena();
+		if(!Backend->AllocArena(Size)) fatal("Failed to allocate %d KB of DMA memory\n",(int)(Size>>10));
+		printf("DMA arena : %d slots of %d steps, %d KB\n",ctx->NUM_SAMPLES,Words-2,(int)(Size>>10));
+	}
 	ctl = (struct control_data_s *)virtbase; // Struct ctl is mapped to the memory allocated by RpiDMA (Mailbox)
+	SampleWords=Words;
+	SampleStepMax=Words-2;
+	memset(ctl->Slots,0,Size-sizeof(struct control_data_s)); // Register writes without password are ignored
+	if(SlotsSize!=ctx->StagingSize)
+	{
+		free(ctx->Staging);
+		if(posix_memalign((void **)&ctx->Staging,64,SlotsSize)!=0) fatal("Failed to allocate staging slots\n");
+		ctx->StagingSize=SlotsSize;
+	}
+	memset(ctx->Staging,0,SlotsSize);
 	dma_cb_t *cbp = ctl->cb;
 
 	uint32_t phys_pwm_fifo_addr = 0x7e20c000 + 0x18;//PWM Fifo
@@ -320,14 +346,14 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 	int samplecnt;
 	
 		
-	for (samplecnt = 0; samplecnt <  NUM_SAMPLES ; samplecnt++)
+	for (samplecnt = 0; samplecnt <  ctx->NUM_SAMPLES ; samplecnt++)
 	{
 		
 
 //@0				
 		//Set Amplitude by writing to PWM_SERIAL via PADS	
 		cbp->info = 0;//BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP  ;
-		cbp->src = mem_virt_to_phys(&ctl->sample[samplecnt].Amplitude1);
+		cbp->src = mem_virt_to_phys(&SampleSlot(ctl,samplecnt)->Amplitude1);
 		cbp->dst = phys_gpio_pads_addr;
 		cbp->length = 4;
 		cbp->stride = 0;
@@ -336,10 +362,10 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 //@1				
 		//Set Amplitude by writing to PWM_SERIAL via Patern	
 		cbp->info = 0;//BCM2708_DMA_NO_WIDE_BURSTS | BCM2708_DMA_WAIT_RESP  ;
-		cbp->src = mem_virt_to_phys(&ctl->sample[samplecnt].Amplitude2); 
-		if(UsePCMClk==0) 
+		cbp->src = mem_virt_to_phys(&SampleSlot(ctl,samplecnt)->Amplitude2); 
+		if(ctx->UsePCMClk==0) 
 			cbp->dst = phys_pwm_fifo_addr;
-		if(UsePCMClk==1) 
+		if(ctx->UsePCMClk==1) 
 			cbp->dst = phys_gpfsel; 				
 		cbp->length = 4;
 		cbp->stride = 0;
@@ -349,19 +375,42 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 		//Set PWMFrequency
 		cbp->info =/*BCM2708_DMA_NO_WIDE_BURSTS*/ BCM2708_DMA_SRC_INC|BCM2708_DMA_NO_WIDE_BURSTS;
 		// BCM2708_DMA_WAIT_RESP : without 160ns, with 300ns
-		cbp->src = mem_virt_to_phys(&ctl->sample[samplecnt].FrequencyTab[0]);
-		if(UsePCMClk==0)		
+		cbp->src = mem_virt_to_phys(&SampleSlot(ctl,samplecnt)->FrequencyTab[0]);
+		if(ctx->UsePCMClk==0)		
 			cbp->dst = phys_pwm_clock_div_addr;
-		if(UsePCMClk==1)		
+		if(ctx->UsePCMClk==1)		
 			cbp->dst = phys_clock_div_addr;
 		cbp->length = 4; //Be updated by main DMA
 		cbp->stride = 0;
 		cbp->next = mem_virt_to_phys(cbp + 1); 
 		cbp++;
+		ctx->StagingLength[samplecnt] = 4;
 	}
 			
 	cbp--;
 	cbp->next = mem_virt_to_phys((void*)virtbase);
+
+	ctx->DmaDone=NULL;
+	if(Bursts>0)
+	{
+		dma_cb_t *Flag=(dma_cb_t *)(virtbase+HandoffOffset);
+		uint32_t *BurstIndex=(uint32_t *)(Flag+Bursts);
+		int b;
+		ctx->DmaDone=BurstIndex+Bursts;
+		ctx->DmaBursts=Bursts;
+		for(b=0;b<Bursts;b++)
+		{
+			dma_cb_t *Last=ctl->cb+((b+1)*ctx->DmaSampleBurstSize-1)*CBS_SIZE_BY_SAMPLE+2; // Ends the burst
+			BurstIndex[b]=b;
+			Flag[b].info=BCM2708_DMA_WAIT_RESP; // Flag in memory before the next burst starts
+			Flag[b].src=mem_virt_to_phys(&BurstIndex[b]);
+			Flag[b].dst=mem_virt_to_phys(ctx->DmaDone);
+			Flag[b].length=4;
+			Flag[b].stride=0;
+			Flag[b].next=Last->next;
+			Last->next=mem_virt_to_phys(&Flag[b]);
+		}
+	}
 			
 
 	// ------------------------------ END DMA INIT ---------------------------------
@@ -374,279 +423,459 @@ int SetupGpioClock(uint32_t SymbolRate,double TuningFrequency)
 	udelay(100);
 	dma_reg[DMA_DEBUG+DMA_CHANNEL*0x40] = 7; // clear debug error flags
 	udelay(100);
-	
-	return 1;		
 }
 
 #define ln(x) (log(x)/log(2.718281828459045235f))
 
-int arctan2(int y, int x) // Should be replaced with fast_atan2 from rtl_fm
+// xorshift32 (Marsaglia) : never returns 0 from a non zero state
+static inline uint32_t Xorshift32(uint32_t *State)
 {
-	int abs_y = abs(y);
-	int angle;
-	if((x==0)&&(y==0)) return 0;
-	if(x >= 0){
-		angle = 45 - 45 * (x - abs_y) / ((x + abs_y)==0?1:(x + abs_y));
-	} else {
-		angle = 135 - 45 * (x + abs_y) / ((abs_y - x)==0?1:(abs_y - x));
-	}
-	return (y < 0) ? -angle : angle; // negate if in quad III or IV
+	uint32_t x=*State;
+	x^=x<<13;
+	x^=x>>17;
+	x^=x<<5;
+	*State=x;
+	return x;
 }
 
-void IQToFreqAmp(int I,int Q,double *Frequency,int *Amp,int SampleRate)
+// Random in [0,Range[ without division
+static inline uint32_t XorshiftRange(uint32_t *State,uint32_t Range)
 {
-	double phase;
-	static double prev_phase = 0;
-	
-	*Amp=round(sqrt( I*I + Q*Q)/sqrt(2));
-	//*Amp=*Amp*3; // Amp*5 pour la voix !! To be tested more
-	if(*Amp>32767)
+	return ((uint64_t)Xorshift32(State)*Range)>>32;
+}
+
+// Fisher-Yates of the ranks, only when a word count is not in the bank (not per sample)
+static int BuildPwmBank(pitx_ctx *ctx,int NbWord)
+{
+	int Way=ctx->PwmBankNext;
+	int b,j;
+	for(b=0;b<PWM_BANK_SIZE;b++)
 	{
-		printf("!");
-		*Amp=32767; //Overload
+		uint8_t *Rank=ctx->PwmBank[Way][b];
+		for(j=0;j<NbWord;j++)
+			Rank[j]=j;
+		for(j=NbWord-1;j>0;j--)
+		{
+			int k=XorshiftRange(&ctx->DitherState,j+1);
+			uint8_t tmp=Rank[j];
+			Rank[j]=Rank[k];
+			Rank[k]=tmp;
+		}
 	}
-
-	phase = M_PI + ((float)arctan2(I,Q)) * M_PI/180.0f;
-	double dp = phase - prev_phase;
-	if(dp < 0) dp = dp + 2*M_PI;
-    
-	*Frequency = dp*SampleRate/(2.0f*M_PI);
-	prev_phase = phase;
-	//printf("I=%d Q=%d Amp=%d Freq=%d\n",I,Q,*Amp,*Frequency);
+	ctx->PwmBankNbWord[Way]=NbWord;
+	ctx->PwmBankNext=(Way+1)%PWM_BANK_WAYS;
+	return Way;
 }
 
+static inline int FindPwmBank(pitx_ctx *ctx,int NbWord)
+{
+	int Way;
+	for(Way=0;Way<PWM_BANK_WAYS;Way++)
+		if(ctx->PwmBankNbWord[Way]==NbWord) return Way;
+	return BuildPwmBank(ctx,NbWord);
+}
 
+// Forget the bank and restart the sequence : same output for the same input
+static void ResetPwmDither(pitx_ctx *ctx)
+{
+	int Way;
+	for(Way=0;Way<PWM_BANK_WAYS;Way++)
+		ctx->PwmBankNbWord[Way]=-1;
+	ctx->PwmBankNext=0;
+	ctx->DitherState=PWM_DITHER_SEED;
+}
 
+// Margin is the number of F2 steps reserved for the DMA overhead
+static void BuildPwmPattern(pitx_ctx *ctx,int PwmNumberStep,int Margin)
+{
+	int NbWord=PwmNumberStep-1-Margin; // Words before the last F2
+	pwmpattern_t *Pattern=ctx->PwmPattern[PwmNumberStep&1];
+	int Adapt;
+	if(NbWord<0) NbWord=0;
+	for(Adapt=0;(Adapt<=PwmNumberStep)&&(Adapt<=PWM_STEP_MAXI);Adapt++)
+	{
+		int NbF2=PwmNumberStep-Adapt-1-Margin;
+		int Pairs=(NbF2<0)?0:NbF2;
+		if(Pairs>Adapt) Pairs=Adapt;
+		Pattern[Adapt].Pairs=Pairs;
+		Pattern[Adapt].Run=NbWord-2*Pairs;
+		Pattern[Adapt].RunIsF1=(Adapt>Pairs);
+	}
+	ctx->PwmPatternNbStep[PwmNumberStep&1]=PwmNumberStep;
+	ctx->PwmPatternMargin[PwmNumberStep&1]=Margin;
+}
 
-inline void shuffle_int(uint32_t list[], size_t len)
-{		
-	int j;						
-	uint32_t tmp;					
-	while(len)
-	{					
-		j = rand() % (len+1);				
-		if (j != len - 1)
-		{			
-			tmp = list[j];			
-			list[j] = list[len - 1];	
-			list[len - 1] = tmp;		
-		}					
-		len--;					
-	}						
-}	
+typedef uint64_t __attribute__((may_alias)) uint64_alias_t;
 
-inline void FrequencyAmplitudeToRegister(double TuneFrequency,uint32_t Amplitude,int NoSample,uint32_t WaitNanoSecond,uint32_t SampleRate,char NoUsePWMF,int debug)
+// Return the number of words written (FrequencyTab is 8 bytes aligned)
+static inline int FillPwmPattern(uint32_t *FrequencyTab,const pwmpattern_t *Pattern,uint32_t RegisterF1,uint32_t RegisterF2)
 {
-	static char ShowInfo=1;				
-				
-	static uint32_t CompteurDebug=0;
-	#define DEBUG_RATE 20000
-	int PwmNumberStep;
-	CompteurDebug++;
-	static uint32_t TabPwmAmplitude[18]={0x00000000,
-									0x80000000,0xA0000000,0xA8000000,0xAA000000,
-									0xAA800000,0xAAA00000,0xAAA80000,0xAAAA0000,
-									0xAAAA8000,0xAAAAA000,0xAAAAA800,0xAAAAAA00,
-									0xAAAAAA80,0xAAAAAAA0,0xAAAAAAA8,0xAAAAAAAA,0xAAAAAAAA};
-	
-	
-	
-	static char First=1;
-				
-	ctl = (struct control_data_s *)virtbase; // Struct ctl is mapped to the memory allocated by RpiDMA (Mailbox)
-	dma_cb_t *cbp = ctl->cb+NoSample*CBS_SIZE_BY_SAMPLE;
-				
-	static dma_cb_t *cbpwrite;
-	uint32_t TimeRemaining=0;
-				
-	int SkipFrequency=0; //When WaitNano is too short, we don't set the frequency
+	uint64_alias_t *Pair=(uint64_alias_t *)FrequencyTab;
+	uint64_t PairValue=((uint64_t)RegisterF2<<32)|RegisterF1; // F1 first (little endian)
+	uint32_t RunValue=Pattern->RunIsF1?RegisterF1:RegisterF2;
+	uint32_t *Run=FrequencyTab+2*Pattern->Pairs;
+	int j;
+	for(j=0;j<Pattern->Pairs;j++)
+		Pair[j]=PairValue;
+	for(j=0;j<Pattern->Run;j++)
+		Run[j]=RunValue;
+	return 2*Pattern->Pairs+Pattern->Run;
+}
 
-	// WITH DMA_CTL WITHOUT BCM2708_DMA_WAIT_RESP
-	// Time = NBStep * 157 ns + 1360 ns
-				
-	
-				
-	
-	if(WaitNanoSecond==0)
-	{
-		if(SampleRate!=0)
-				WaitNanoSecond = (1e9/SampleRate);
-	}	
-				
-	PwmNumberStep=WaitNanoSecond/FREQ_MINI_TIMING;
-	if(PwmNumberStep>PWM_STEP_MAXI) PwmNumberStep=PWM_STEP_MAXI;
-				
+// Same F1/F2 counts as FillPwmPattern, spread by one permutation of the bank
+// rotated by a random offset : one xorshift per sample instead of one rand() per word
+static inline int FillPwmPatternRandom(pitx_ctx *ctx,uint32_t *FrequencyTab,const pwmpattern_t *Pattern,uint32_t RegisterF1,uint32_t RegisterF2)
+{
+	int NbWord=2*Pattern->Pairs+Pattern->Run;
+	int NbF1=Pattern->Pairs+(Pattern->RunIsF1?Pattern->Run:0);
+	uint32_t Random;
+	const uint8_t *Rank;
+	int Way,Rotate,j;
+
+	if(NbWord==0) return 0;
+	Way=FindPwmBank(ctx,NbWord);
+	Random=Xorshift32(&ctx->DitherState);
+	Rank=ctx->PwmBank[Way][Random&(PWM_BANK_SIZE-1)];
+	Rotate=((uint64_t)(Random>>8)*NbWord)>>24;
+	for(j=0;j<NbWord-Rotate;j++)
+		FrequencyTab[j]=(Rank[j+Rotate]<NbF1)?RegisterF1:RegisterF2;
+	for(;j<NbWord;j++)
+		FrequencyTab[j]=(Rank[j+Rotate-NbWord]<NbF1)?RegisterF1:RegisterF2;
+	return NbWord;
+}
 
-	// ********************************** PWM FREQUENCY PROCESSING *****************************
-				
-	if(UsePCMClk==0)
-		TuneFrequency*=2.0; //Because of pattern 10
-				
-	// F1 < TuneFrequency < F2
+static void UpdateFreqBand(freqband_t *Band,uint32_t PllUsed,double TuneFrequency)
+{
 	uint32_t FreqDividerf2=(int) ((double)PllUsed/TuneFrequency);
 	uint32_t FreqFractionnalf2=4096.0 * (((double)PllUsed/TuneFrequency)-FreqDividerf2);
 				
 	uint32_t FreqDividerf1=(FreqFractionnalf2!=4095)?FreqDividerf2:FreqDividerf2+1;				
 	uint32_t FreqFractionnalf1=(FreqFractionnalf2!=4095)?FreqFractionnalf2+1:0;
 	
-	double f1=PllUsed/(FreqDividerf1+(double)FreqFractionnalf1/4096.0);
-	double f2=PllUsed/(FreqDividerf2+(double)FreqFractionnalf2/4096.0); // f2 is the higher frequency
-	double FreqTuningUp=PllUsed/(FreqDividerf2+(double)FreqFractionnalf2/4096.0);
+	Band->PllUsed=PllUsed;
+	Band->f1=PllUsed/(FreqDividerf1+(double)FreqFractionnalf1/4096.0);
+	Band->f2=PllUsed/(FreqDividerf2+(double)FreqFractionnalf2/4096.0);
+	Band->RegisterF1=0x5A000000 | (FreqDividerf1<<12) | (FreqFractionnalf1);
+	Band->RegisterF2=0x5A000000 | (FreqDividerf2<<12) | (FreqFractionnalf2);
+	Band->NbStep=-1;
+}
 
-	double FreqStep=f2-f1;
-	static uint32_t RegisterF1;
-	static uint32_t RegisterF2;		
-							
-	if(ShowInfo==1)
-	{
-		printf("WaitNano=%d F1=%f TuneFrequency %f F2=%f Initial Resolution(Hz)=%f ResolutionPWMF %f NbStep=%d DELAYStep=%d\n",WaitNanoSecond,f1,TuneFrequency,f2,FreqStep,FreqStep/(PwmNumberStep),PwmNumberStep,(PWMF_MARGIN+FREQ_DELAY_TIME)/FREQ_MINI_TIMING);
-		ShowInfo=0;
-	}
-				
-	static int DebugStep=71;
-	double	fPWMFrequency=((FreqTuningUp-TuneFrequency)*1.0*(double)(PwmNumberStep)/FreqStep); // Give NbStep of F2
-	int PWMFrequency=round(fPWMFrequency);
-				
-	//printf("PWMF =%d PWMSTEP=%d\n",PWMFrequency,PwmNumberStep);
-	/*if((CompteurDebug%DEBUG_RATE)==0)
-	{
-		DebugStep=(DebugStep+1)%PwmNumberStep;
-		//printf("PwmNumberStep %d Step %d\n",PwmNumberStep,DebugStep);
-	}
-	PWMFrequency=(DebugStep);*/
-				
-	//if((CompteurDebug%200)==0) printf("PwmNumberStep =%d TuneFrequency %f : FreqTuning %f FreqStep %f PwmFreqStep %f fPWMFrequency %f PWMFrequency %d f1 %f f2 %f %x %x\n",PwmNumberStep,TuneFrequency,FreqTuning,FreqStep,FreqStep/PwmNumberStep,fPWMFrequency,PWMFrequency,f1,f2,RegisterF1,RegisterF2);
+// Refill kernels : FrequencyAmplitudeToRegister is instantiated for each output pin x PWMF option
+// x envelope with constant arguments, so the per sample branches are resolved at compile time.
+// pitx_run_ctx selects the kernel once (SelectRefillKernel).
+#define OUTPUT_PWM 0 // GPIO18 : frequency doubled because of the 10 pattern
+#define OUTPUT_GPCLK 1 // GPIO4
+#define PWMF_NONE 0 // -w 1 : F2 only
+#define PWMF_PATTERN 1 // F1/F2 interleaving
+#define PWMF_RANDOM 2 // -r : interleaving taken from the pre-shuffled bank
+#define ENVELOPE_FULL 0 // IQ, IQFLOAT, RFA : 8 amplitude steps
+#define ENVELOPE_ONOFF 1 // RF : carrier on (any amplitude) or off (0)
+#define ENVELOPE_CONST 2 // VFO : amplitude written once for every slot (SetConstantEnvelope)
+
+// Encoders write the cached staging slot, PublishSlots copies it to the DMA arena
+static inline sample_t *StagingSlot(pitx_ctx *ctx,int NoSample)
+{
+	return (sample_t *)(ctx->Staging+NoSample*SampleWords);
+}
 
-	int i;
-				
-	static int NbF1,NbF2,NbF1F2;
-	NbF1=0;
-	NbF2=0;
-	NbF1F2=0;
+static inline __attribute__((always_inline)) void AmplitudeToRegister(pitx_ctx *ctx,uint32_t IntAmplitude,int NoSample,const int Output)
+{
+	sample_t *Slot=StagingSlot(ctx,NoSample);
+	if(Output==OUTPUT_PWM)
+		Slot->Amplitude2=(IntAmplitude==0)?0x0:0xAAAAAAAA;
+	else
+		Slot->Amplitude2=(ctx->Originfsel & ~(7 << 12)) | (((IntAmplitude==0)?0:4) << 12);
+	Slot->Amplitude1=0x5a000000 + (IntAmplitude&0x7) + (1<<4) + (0<<3); 
+}
 
-	
-	int AdaptPWMFrequency;			
-	if((PwmNumberStep-PWMFrequency-(PWMF_MARGIN+FREQ_DELAY_TIME)/FREQ_MINI_TIMING)>PwmNumberStep/2)
+// PwmNumberStep (SampleSteps) : slot duration, the same for every frequency
+static inline __attribute__((always_inline)) void FrequencyAmplitudeToRegister(pitx_ctx *ctx,double TuneFrequency,uint32_t Amplitude,int NoSample,uint32_t WaitNanoSecond,int PwmNumberStep,int MarginStep,const int Output,const int Pwmf,const int Envelope)
+{
+	uint32_t *FrequencyTab=StagingSlot(ctx,NoSample)->FrequencyTab;
+
+	// ********************************** PWM FREQUENCY PROCESSING *****************************
+				
+	if(Output==OUTPUT_PWM)
+		TuneFrequency*=2.0; //Because of pattern 10
+				
+	// F1 < TuneFrequency <= F2 : dividers only change when leaving the band
+	if((TuneFrequency<=ctx->FreqBand.f1)||(TuneFrequency>ctx->FreqBand.f2)||(ctx->FreqBand.PllUsed!=ctx->PllUsed))
+		UpdateFreqBand(&ctx->FreqBand,ctx->PllUsed,TuneFrequency);
+	if(ctx->FreqBand.NbStep!=PwmNumberStep)
 	{
-		RegisterF1=0x5A000000 | (FreqDividerf1<<12) | (FreqFractionnalf1);
-		RegisterF2=0x5A000000 | (FreqDividerf2<<12) | (FreqFractionnalf2);
-		AdaptPWMFrequency=PWMFrequency;
-		NbF1=0;
-		NbF2=(PWMF_MARGIN+FREQ_DELAY_TIME)/FREQ_MINI_TIMING;
-		
+		ctx->FreqBand.StepScale=(double)PwmNumberStep/(ctx->FreqBand.f2-ctx->FreqBand.f1);
+		ctx->FreqBand.NbStep=PwmNumberStep;
 	}
-	else // SWAP F1 AND F2
+	uint32_t RegisterF1;
+	uint32_t RegisterF2;		
+							
+	if(__builtin_expect(ctx->ShowInfo==1,0))
 	{
-		//if((CompteurDebug%DEBUG_RATE)==0) printf("-");
-		RegisterF2=0x5A000000 | (FreqDividerf1<<12) | (FreqFractionnalf1);
-		RegisterF1=0x5A000000 | (FreqDividerf2<<12) | (FreqFractionnalf2);
-		AdaptPWMFrequency=PwmNumberStep-PWMFrequency;
-		NbF1=0;
-		NbF2=(PWMF_MARGIN+FREQ_DELAY_TIME)/FREQ_MINI_TIMING;
+		double FreqStep=ctx->FreqBand.f2-ctx->FreqBand.f1;
+		printf("WaitNano=%d F1=%f TuneFrequency %f F2=%f Initial Resolution(Hz)=%f ResolutionPWMF %f NbStep=%d DELAYStep=%d\n",WaitNanoSecond,ctx->FreqBand.f1,TuneFrequency,ctx->FreqBand.f2,FreqStep,FreqStep/(PwmNumberStep),PwmNumberStep,MarginStep);
+		ctx->ShowInfo=0;
 	}
 				
-	i=0;
-	NbF1F2=NbF1+NbF2;
-	
-	if(NoUsePWMF==1)
+	int i;
+
+	if(Pwmf==PWMF_NONE)
 	{
-		RegisterF1=0x5A000000 | (FreqDividerf1<<12) | (FreqFractionnalf1);
-		RegisterF2=0x5A000000 | (FreqDividerf2<<12) | (FreqFractionnalf2);
 		i=0;
-		ctl->sample[NoSample].FrequencyTab[i++]=RegisterF2;
+		FrequencyTab[i++]=ctx->FreqBand.RegisterF2;
 	}
 	else
 	{			
-		while(NbF1F2<PwmNumberStep-1)
+		double	fPWMFrequency=(ctx->FreqBand.f2-TuneFrequency)*ctx->FreqBand.StepScale; // Give NbStep of F2
+		int PWMFrequency=(int)(fPWMFrequency+0.5); // Always >=0 inside the band
+		int AdaptPWMFrequency;			
+
+		if((PwmNumberStep-PWMFrequency-MarginStep)>PwmNumberStep/2)
 		{
-			if(NbF1<AdaptPWMFrequency) 
-			{
-				ctl->sample[NoSample].FrequencyTab[i++]=RegisterF1;
-				NbF1++;
-				NbF1F2++;
-			}
-			if(NbF2<PwmNumberStep-AdaptPWMFrequency-1)
-			{
-				ctl->sample[NoSample].FrequencyTab[i++]=RegisterF2;
-				NbF2++;
-				NbF1F2++;
-			}
+			RegisterF1=ctx->FreqBand.RegisterF1;
+			RegisterF2=ctx->FreqBand.RegisterF2;
+			AdaptPWMFrequency=PWMFrequency;
+		}
+		else // SWAP F1 AND F2
+		{
+			RegisterF2=ctx->FreqBand.RegisterF1;
+			RegisterF1=ctx->FreqBand.RegisterF2;
+			AdaptPWMFrequency=PwmNumberStep-PWMFrequency;
 		}
-		if (Randomize)
-			shuffle_int(ctl->sample[NoSample].FrequencyTab,i);
+
+		const int Way=PwmNumberStep&1;
+		if((ctx->PwmPatternNbStep[Way]!=PwmNumberStep)||(ctx->PwmPatternMargin[Way]!=MarginStep))
+			BuildPwmPattern(ctx,PwmNumberStep,MarginStep);
+		if(Pwmf==PWMF_RANDOM)
+			i=FillPwmPatternRandom(ctx,FrequencyTab,&ctx->PwmPattern[Way][AdaptPWMFrequency],RegisterF1,RegisterF2);
+		else
+			i=FillPwmPattern(FrequencyTab,&ctx->PwmPattern[Way][AdaptPWMFrequency],RegisterF1,RegisterF2);
 			
 		//SHould finished by F2
-		ctl->sample[NoSample].FrequencyTab[i++]=RegisterF2;
-		NbF2++;
-		NbF1F2++;
+		FrequencyTab[i++]=RegisterF2;
 	}	
 				
-	cbpwrite=cbp+2;
-	cbpwrite->length=i*4;
-
-	
+	ctx->StagingLength[NoSample]=i*4;
 				
 	// ****************************** AMPLITUDE PROCESSING **********************************************
 				
-	
-	Amplitude=(Amplitude>32767)?32767:Amplitude;	
-	int IntAmplitude=(Amplitude*7.0)/32767.0; // Convert to 8 amplitude step
-				
-	if(UsePCMClk==0)
+	if(Envelope==ENVELOPE_FULL)
 	{
-		if(IntAmplitude==0)
-		{
-			ctl->sample[NoSample].Amplitude2=0x0;
-		}
-		else
-		{
-			ctl->sample[NoSample].Amplitude2=0xAAAAAAAA;					
-		}
+		Amplitude=(Amplitude>32767)?32767:Amplitude;	
+		AmplitudeToRegister(ctx,(Amplitude*7)/32767,NoSample,Output); // Convert to 8 amplitude step
 	}
-	if(UsePCMClk==1)
+	if(Envelope==ENVELOPE_ONOFF)
+		AmplitudeToRegister(ctx,(Amplitude!=0)?7:0,NoSample,Output);
+}
+
+// PwmNumberStep of the timing table slot no longer than WaitNanoSecond, *Frac : fraction of a step missing
+static int TimingFloor(pitx_ctx *ctx,uint32_t WaitNanoSecond,double *Frac)
+{
+	const int MarginStep=(ctx->PWMF_MARGIN+FREQ_DELAY_TIME)/ctx->FREQ_MINI_TIMING;
+	const uint32_t *Timing=ctx->Timing;
+	int Words=1; // Last F2 is always written
+	double Fraction=0;
+
+	while((Words+1<ctx->NbTiming)&&(Timing[Words+1]<=WaitNanoSecond)) Words++;
+	if((Words+1<ctx->NbTiming)&&(WaitNanoSecond>Timing[Words]))
+		Fraction=(double)(WaitNanoSecond-Timing[Words])/(Timing[Words+1]-Timing[Words]);
+	if(Frac!=NULL) *Frac=Fraction;
+	return Words+MarginStep; // The encoder writes PwmNumberStep-MarginStep words
+}
+
+// PwmNumberStep of a sample. Timing table : one more step each time the carried
+// fractions reach a whole step, so the mean slot duration is WaitNanoSecond
+static inline int SampleSteps(pitx_ctx *ctx,uint32_t WaitNanoSecond)
+{
+	int PwmNumberStep;
+
+	// WITH DMA_CTL WITHOUT BCM2708_DMA_WAIT_RESP
+	// Time = NBStep * 157 ns + 1360 ns
+	if(ctx->NbTiming==0)
+		PwmNumberStep=WaitNanoSecond/ctx->FREQ_MINI_TIMING;
+	else
 	{
-		if(IntAmplitude==0)
+		if(WaitNanoSecond!=ctx->TimingWait)
 		{
-			ctl->sample[NoSample].Amplitude2=(Originfsel & ~(7 << 12)) | (0 << 12);
+			ctx->TimingStep=TimingFloor(ctx,WaitNanoSecond,&ctx->TimingFrac);
+			ctx->TimingWait=WaitNanoSecond;
 		}
-		else
+		PwmNumberStep=ctx->TimingStep;
+		ctx->TimingCarry+=ctx->TimingFrac;
+		if(ctx->TimingCarry>=1.0)
 		{
-			ctl->sample[NoSample].Amplitude2=(Originfsel & ~(7 << 12)) | (4 << 12);
+			ctx->TimingCarry-=1.0;
+			PwmNumberStep++;
 		}
 	}
+	if(PwmNumberStep>SampleStepMax) PwmNumberStep=SampleStepMax; // Slot size of the run (SetupDmaArena)
+	return PwmNumberStep;
+}
 
-	static int OldIntAmplitude=0;
-				
-	
-	if(IntAmplitude>7) IntAmplitude=7;
-	
-	ctl->sample[NoSample].Amplitude1=0x5a000000 + (IntAmplitude&0x7) + (1<<4) + (0<<3); 
-				
+static inline int SameTxSample(const txsample_t *a,const txsample_t *b)
+{
+	return (a->Frequency==b->Frequency)&&(a->Amplitude==b->Amplitude)&&(a->WaitNanoSecond==b->WaitNanoSecond);
+}
+
+// Every slot will be encoded again (CBs rewritten by calibration, new run options)
+static void ResetSlotSamples(pitx_ctx *ctx)
+{
+	int NoSample;
+	for(NoSample=0;NoSample<NUM_SAMPLES_MAX;NoSample++)
+		ctx->SlotSample[NoSample].Frequency=NAN;
+}
+
+// Copy Count staged slots from First (no wrap) to the DMA arena : one burst copy for the
+// packed slots, then the lengths of their CBs. The DMA is behind these slots, it only
+// reads them after the refill (barrier at the end of the kernel)
+static void PublishSlots(pitx_ctx *ctx,int First,int Count)
+{
+	dma_cb_t *cbp=ctl->cb+First*CBS_SIZE_BY_SAMPLE+2;
+	int i;
+
+	if(Count==0) return;
+	memcpy(SampleSlot(ctl,First),StagingSlot(ctx,First),(size_t)Count*SampleWords*sizeof(uint32_t));
+	for(i=0;i<Count;i++,cbp+=CBS_SIZE_BY_SAMPLE)
+		cbp->length=ctx->StagingLength[First+i];
+}
+
+// Encode Count samples of the ring from DMA slot NoSample, slots already holding the same sample are skipped.
+// Encoded slots are published by runs of consecutive slots.
+typedef void (*refill_kernel_t)(pitx_ctx *ctx,txring_t *Ring,int NoSample,int Count);
+
+#define DEFINE_REFILL_KERNEL(Name,Output,Pwmf,Envelope) \
+static void RefillKernel##Name(pitx_ctx *ctx,txring_t *Ring,int NoSample,int Count) \
+{ \
+	const int MarginStep=(ctx->PWMF_MARGIN+FREQ_DELAY_TIME)/ctx->FREQ_MINI_TIMING; /* F2 steps kept for DMA overhead */ \
+	int i; \
+	int Reused=0; \
+	int Run=0; /* Encoded slots not published, ending before NoSample */ \
+	ctl = (struct control_data_s *)virtbase; /* Struct ctl is mapped to the memory allocated by RpiDMA (Mailbox) */ \
+	for(i=0;i<Count;i++) \
+	{ \
+		const txsample_t *Sample=RingReadSlot(Ring,i); \
+		txsample_t *Encoded=&ctx->SlotSample[NoSample]; \
+		const int PwmNumberStep=SampleSteps(ctx,Sample->WaitNanoSecond); \
+		/* Slot already holds this sample : steady carrier costs no encoding. */ \
+		/* Not with -r : the dither would repeat every DMA lap (spurs) */ \
+		if((Pwmf!=PWMF_RANDOM)&&SameTxSample(Sample,Encoded)&&(ctx->SlotStep[NoSample]==PwmNumberStep)) \
+		{ \
+			Reused++; \
+			PublishSlots(ctx,NoSample-Run,Run); \
+			Run=0; \
+		} \
+		else \
+		{ \
+			FrequencyAmplitudeToRegister(ctx,Sample->Frequency,Sample->Amplitude,NoSample,Sample->WaitNanoSecond,PwmNumberStep,MarginStep,Output,Pwmf,Envelope); \
+			*Encoded=*Sample; \
+			ctx->SlotStep[NoSample]=PwmNumberStep; \
+			Run++; \
+		} \
+		if(++NoSample==ctx->NUM_SAMPLES) \
+		{ \
+			PublishSlots(ctx,NoSample-Run,Run); \
+			Run=0; \
+			NoSample=0; \
+		} \
+	} \
+	PublishSlots(ctx,NoSample-Run,Run); \
+	__sync_synchronize(); /* Slots written before the DMA position is read again */ \
+	StatAdd(&ctx->Stat->SlotsReused,Reused); \
+}
+
+DEFINE_REFILL_KERNEL(PwmNoneFull,OUTPUT_PWM,PWMF_NONE,ENVELOPE_FULL)
+DEFINE_REFILL_KERNEL(PwmNoneOnOff,OUTPUT_PWM,PWMF_NONE,ENVELOPE_ONOFF)
+DEFINE_REFILL_KERNEL(PwmNoneConst,OUTPUT_PWM,PWMF_NONE,ENVELOPE_CONST)
+DEFINE_REFILL_KERNEL(PwmPatternFull,OUTPUT_PWM,PWMF_PATTERN,ENVELOPE_FULL)
+DEFINE_REFILL_KERNEL(PwmPatternOnOff,OUTPUT_PWM,PWMF_PATTERN,ENVELOPE_ONOFF)
+DEFINE_REFILL_KERNEL(PwmPatternConst,OUTPUT_PWM,PWMF_PATTERN,ENVELOPE_CONST)
+DEFINE_REFILL_KERNEL(PwmRandomFull,OUTPUT_PWM,PWMF_RANDOM,ENVELOPE_FULL)
+DEFINE_REFILL_KERNEL(PwmRandomOnOff,OUTPUT_PWM,PWMF_RANDOM,ENVELOPE_ONOFF)
+DEFINE_REFILL_KERNEL(PwmRandomConst,OUTPUT_PWM,PWMF_RANDOM,ENVELOPE_CONST)
+DEFINE_REFILL_KERNEL(GpclkNoneFull,OUTPUT_GPCLK,PWMF_NONE,ENVELOPE_FULL)
+DEFINE_REFILL_KERNEL(GpclkNoneOnOff,OUTPUT_GPCLK,PWMF_NONE,ENVELOPE_ONOFF)
+DEFINE_REFILL_KERNEL(GpclkNoneConst,OUTPUT_GPCLK,PWMF_NONE,ENVELOPE_CONST)
+DEFINE_REFILL_KERNEL(GpclkPatternFull,OUTPUT_GPCLK,PWMF_PATTERN,ENVELOPE_FULL)
+DEFINE_REFILL_KERNEL(GpclkPatternOnOff,OUTPUT_GPCLK,PWMF_PATTERN,ENVELOPE_ONOFF)
+DEFINE_REFILL_KERNEL(GpclkPatternConst,OUTPUT_GPCLK,PWMF_PATTERN,ENVELOPE_CONST)
+DEFINE_REFILL_KERNEL(GpclkRandomFull,OUTPUT_GPCLK,PWMF_RANDOM,ENVELOPE_FULL)
+DEFINE_REFILL_KERNEL(GpclkRandomOnOff,OUTPUT_GPCLK,PWMF_RANDOM,ENVELOPE_ONOFF)
+DEFINE_REFILL_KERNEL(GpclkRandomConst,OUTPUT_GPCLK,PWMF_RANDOM,ENVELOPE_CONST)
+
+static const refill_kernel_t RefillKernels[2][3][3]={ // [Output][Pwmf][Envelope]
+	{
+		{RefillKernelPwmNoneFull,RefillKernelPwmNoneOnOff,RefillKernelPwmNoneConst},
+		{RefillKernelPwmPatternFull,RefillKernelPwmPatternOnOff,RefillKernelPwmPatternConst},
+		{RefillKernelPwmRandomFull,RefillKernelPwmRandomOnOff,RefillKernelPwmRandomConst}
+	},
+	{
+		{RefillKernelGpclkNoneFull,RefillKernelGpclkNoneOnOff,RefillKernelGpclkNoneConst},
+		{RefillKernelGpclkPatternFull,RefillKernelGpclkPatternOnOff,RefillKernelGpclkPatternConst},
+		{RefillKernelGpclkRandomFull,RefillKernelGpclkRandomOnOff,RefillKernelGpclkRandomConst}
+	}
+};
 
+// VFO : amplitude never changes, write it in every slot before starting
+static void SetConstantEnvelope(pitx_ctx *ctx,uint32_t Amplitude)
+{
+	int NoSample;
+	Amplitude=(Amplitude>32767)?32767:Amplitude;	
+	ctl = (struct control_data_s *)virtbase;
+	for(NoSample=0;NoSample<ctx->NUM_SAMPLES;NoSample++)
+	{
+		if(ctx->UsePCMClk==0)
+			AmplitudeToRegister(ctx,(Amplitude*7)/32767,NoSample,OUTPUT_PWM);
+		else
+			AmplitudeToRegister(ctx,(Amplitude*7)/32767,NoSample,OUTPUT_GPCLK);
+	}
+	PublishSlots(ctx,0,ctx->NUM_SAMPLES);
 }
 
+static refill_kernel_t SelectRefillKernel(pitx_ctx *ctx,char Mode,char NoUsePwmFrequency)
+{
+	int Output=(ctx->UsePCMClk==0)?OUTPUT_PWM:OUTPUT_GPCLK;
+	int Pwmf=PWMF_PATTERN;
+	int Envelope=ENVELOPE_FULL;
+
+	if(NoUsePwmFrequency==1) Pwmf=PWMF_NONE;
+	else if(ctx->Randomize) Pwmf=PWMF_RANDOM;
+	if(Mode==MODE_RF) Envelope=ENVELOPE_ONOFF;
+	if(Mode==MODE_VFO) Envelope=ENVELOPE_CONST;
+	return RefillKernels[Output][Pwmf][Envelope];
+}
 
 
 
 
-int GetDMADelay(int Step)
+// Tracker of the slots of the DMA ring (CB position, or completion flags)
+static void InitDmaPos(pitx_ctx *ctx,dmapos_t *Pos)
+{
+	DmaPosInit(Pos,mem_virt_to_phys(ctl->cb),sizeof(dma_cb_t)*CBS_SIZE_BY_SAMPLE,ctx->NUM_SAMPLES);
+}
+
+// Ring slot of the CB the DMA is reading
+static inline int DmaCbSlot(const dmapos_t *Pos)
+{
+	return DmaPosSlot(Pos,dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]);
+}
+
+// Mean ns of a slot of Step FrequencyTab words over Rounds, *Deviation (if not NULL) : standard deviation of the rounds
+int GetDMADelay(pitx_ctx *ctx,int Step,int Rounds,double *Deviation)
 {
 	
 	//Calibrate DMA Rate
 	// =====================================================
-	static volatile uint32_t cur_cb,last_cb;
 	struct timespec gettime_now;
 	int32_t start_time,time_difference;
-	int last_sample;
-	int this_sample; 
-	int free_slots;
+	dmapos_t Pos;
+	uint64_t StartPlayed;
+	int Played;
 
 	dma_cb_t *cbp = ctl->cb;
-	cur_cb = (uint32_t)virtbase; // DMA AT 1st CBS
-	dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]=mem_virt_to_phys((void*)cur_cb);
+	InitDmaPos(ctx,&Pos); // DMA AT 1st CBS
+	dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]=Pos.Base;
 	usleep(100);
 	int samplecnt;
-	for (samplecnt = 0; samplecnt <  NUM_SAMPLES ; samplecnt++)
+	for (samplecnt = 0; samplecnt <  ctx->NUM_SAMPLES ; samplecnt++)
 	{
 		
 		cbp+=2;
@@ -658,13 +887,13 @@ int GetDMADelay(int Step)
 	usleep(5000); //Wait to be sure DMA is running stable
 	int i;
 	int SumDelay=0;
-	for(i=0;i<10;i++)
+	double SumSquare=0;
+	for(i=0;i<Rounds;i++)
 	{
 
 	
 
-		last_cb = mem_phys_to_virt((uint32_t)(dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]));
-		last_sample = (last_cb - (uint32_t)virtbase) / (sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE);
+		StartPlayed=DmaPosUpdate(&Pos,DmaCbSlot(&Pos));
 
 		clock_gettime(CLOCK_REALTIME, &gettime_now);
 		start_time = gettime_now.tv_nsec;
@@ -675,24 +904,21 @@ int GetDMADelay(int Step)
 		do
 		{
 			usleep(10);
-			cur_cb = mem_phys_to_virt((uint32_t)(dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]));
-			this_sample = (cur_cb - (uint32_t)virtbase) / (sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE);
-			free_slots = this_sample - last_sample;
-			if (free_slots < 0) // WARNING : ORIGINAL CODE WAS < strictly
-				free_slots += NUM_SAMPLES;
+			Played=DmaPosUpdate(&Pos,DmaCbSlot(&Pos))-StartPlayed;
 			clock_gettime(CLOCK_REALTIME, &gettime_now);
 		
 		}
-		while(free_slots<=NUM_SAMPLES*0.6);
+		while(Played<=ctx->NUM_SAMPLES*0.6);
 	 	
 	
 
 		time_difference = gettime_now.tv_nsec - start_time;
 		if(time_difference<0) time_difference+=1E9;
 
-		//printf("Delay = %d\n",time_difference/free_slots);
+		//printf("Delay = %d\n",time_difference/Played);
 
-		SumDelay+=time_difference/free_slots;
+		SumDelay+=time_difference/Played;
+		SumSquare+=(double)(time_difference/Played)*(time_difference/Played);
 	}
 	
 	//STop DMA
@@ -702,10 +928,16 @@ int GetDMADelay(int Step)
 	dma_reg[DMA_CS+DMA_CHANNEL*0x40] |= DMA_CS_RESET; //BCM2708_DMA_ABORT|BCM2708_DMA_RESET;
 	udelay(100);
 
-	return SumDelay/10;
+	if(Deviation!=NULL)
+	{
+		double Mean=(double)SumDelay/Rounds;
+		double Variance=SumSquare/Rounds-Mean*Mean;
+		*Deviation=(Variance>0)?sqrt(Variance):0;
+	}
+	return SumDelay/Rounds;
 }
 
-int CalibrateSystem(int *ppm,int *BaseDelayDMA,int *StepDelayDMA)
+int CalibrateSystem(pitx_ctx *ctx,int *ppm,int *BaseDelayDMA,int *StepDelayDMA)
 {
 	struct timex ntx;
 	int status;
@@ -727,28 +959,185 @@ int CalibrateSystem(int *ppm,int *BaseDelayDMA,int *StepDelayDMA)
 	//printf("Clock PPM = %f\n",ppm);
 	int i; 
 	int BaseDelay=0;
-	BaseDelay=GetDMADelay(0);
+	BaseDelay=GetDMADelay(ctx,0,CALIB_ROUNDS,NULL);
 
 	*BaseDelayDMA=BaseDelay;
-	*StepDelayDMA=(GetDMADelay(PWM_STEP_MAXI/2)-(*BaseDelayDMA))/(PWM_STEP_MAXI/2);
-	//for(i=1;i<200;i+=10)
-		//printf("Step %d =%d\n",i,(GetDMADelay(i)-BaseDelay)/i);
+	*StepDelayDMA=(GetDMADelay(ctx,PWM_STEP_MAXI/2,CALIB_ROUNDS,NULL)-(*BaseDelayDMA))/(PWM_STEP_MAXI/2);
 	return 1;
 }
 
-int pitx_init(int SampleRate, double TuningFrequency, int* skipSignals,int SetDma)
-{	
-	InitGpio();
-	InitDma(terminate, skipSignals);
+// Slot time of every word count 0..PWM_STEP_MAXI (the linear fit misses the bus effects between its two points)
+static void CalibrateTimingTable(pitx_ctx *ctx)
+{
+	double Deviation,SumDeviation=0,MaxDeviation=0;
+	int Words,MaxWords=0;
+
+	printf("Timing table : measuring %d step counts\n",PWM_STEP_MAXI+1);
+	for(Words=0;Words<=PWM_STEP_MAXI;Words++)
+	{
+		uint32_t Time=GetDMADelay(ctx,Words,CALIB_TABLE_ROUNDS,&Deviation);
+		if((Words>0)&&(Time<=ctx->Timing[Words-1])) Time=ctx->Timing[Words-1]+1; // Increasing for TimingFloor
+		ctx->Timing[Words]=Time;
+		SumDeviation+=Deviation;
+		if(Deviation>MaxDeviation)
+		{
+			MaxDeviation=Deviation;
+			MaxWords=Words;
+		}
+	}
+	ctx->NbTiming=PWM_STEP_MAXI+1;
+	printf("Timing table : %dns..%dns, deviation mean %.0fns max %.0fns (%d steps)\n",ctx->Timing[0],ctx->Timing[PWM_STEP_MAXI],SumDeviation/ctx->NbTiming,MaxDeviation,MaxWords);
+}
+
+static void CalibStore(pitx_ctx *ctx)
+{
+	calibentry_t Entry;
+	Entry.FreqMiniTiming=ctx->FREQ_MINI_TIMING;
+	Entry.PwmfMargin=ctx->PWMF_MARGIN;
+	Entry.Ppm=ctx->globalppmpll;
+	Entry.Time=time(NULL);
+	Entry.NbTiming=ctx->NbTiming;
+	memcpy(Entry.Timing,ctx->Timing,sizeof(Entry.Timing));
+	if(!CalibSave(ctx->CalibFile,ctx->CalibKey,&Entry))
+		printf("Warning : calibration cache %s not written\n",ctx->CalibFile);
+}
+
+// Calibration from the cache entry of this system, checked by one round of GetDMADelay. 0 : measure
+static int CalibrateFromCache(pitx_ctx *ctx)
+{
+	calibentry_t Entry;
+
+	if((ctx->CalibMode==CALIB_MEASURE)||(ctx->CalibMode==CALIB_FULL)) return 0;
+	if(!CalibLoad(ctx->CalibFile,ctx->CalibKey,&Entry)) return 0;
+	if(ctx->CalibMode==CALIB_CHECK)
+	{
+		int Expected=Entry.PwmfMargin+Entry.FreqMiniTiming*(PWM_STEP_MAXI/2);
+		int Measured=GetDMADelay(ctx,PWM_STEP_MAXI/2,1,NULL);
+		if(Entry.NbTiming>PWM_STEP_MAXI/2) Expected=Entry.Timing[PWM_STEP_MAXI/2];
+		if(abs(Measured-Expected)*100>Expected*CALIB_CHECK_PERCENT)
+		{
+			printf("Calibration cache : slot of %d steps is %dns instead of %dns, calibrating\n",PWM_STEP_MAXI/2,Measured,Expected);
+			return 0;
+		}
+	}
+	ctx->FREQ_MINI_TIMING=Entry.FreqMiniTiming;
+	ctx->PWMF_MARGIN=Entry.PwmfMargin;
+	ctx->globalppmpll=Entry.Ppm;
+	ctx->NbTiming=Entry.NbTiming;
+	memcpy(ctx->Timing,Entry.Timing,sizeof(ctx->Timing));
+	ctx->CalibRefresh=(time(NULL)-Entry.Time>CALIB_REFRESH_AGE);
+	printf("Calibrate : ppm=%d DMA %dns:%dns%s (cache)\n",ctx->globalppmpll,ctx->FREQ_MINI_TIMING,ctx->PWMF_MARGIN,(ctx->NbTiming>0)?" timing table":"");
+	return 1;
+}
+
+// DMA is idle after the run : linear fit measured again for the next startups, off air.
+// The timing table is kept, it is only measured by --calib full
+static void RefreshCalibration(pitx_ctx *ctx)
+{
+	ctx->CalibRefresh=0;
+	RfOutput(ctx,0);
+	dma_reg[DMA_CS+DMA_CHANNEL*0x40] |= DMA_CS_ABORT;
+	udelay(100);
+	dma_reg[DMA_CS+DMA_CHANNEL*0x40]&= ~DMA_CS_ACTIVE;
+	SetupDmaArena(ctx,1,0);
+	if(CalibrateSystem(ctx,&ctx->globalppmpll,&ctx->PWMF_MARGIN,&ctx->FREQ_MINI_TIMING))
+	{
+		printf("Calibration cache refreshed : ppm=%d DMA %dns:%dns\n",ctx->globalppmpll,ctx->FREQ_MINI_TIMING,ctx->PWMF_MARGIN);
+		CalibStore(ctx);
+	}
+}
+
+pitx_ctx *pitx_open(int* skipSignals,int SetDma)
+{
+	pitx_ctx *ctx;
+
+	// ctl, virtbase, DMA_CHANNEL and Backend are process wide : a second context would take over the DMA of the first
+	if(SignalCtx!=NULL)
+	{
+		fprintf(stderr,"pitx_open : a context is already open, pitx_close it first\n");
+		return NULL;
+	}
+	ctx=calloc(1,sizeof(pitx_ctx));
+	if(ctx==NULL) return NULL;
+
+	ctx->DmaSampleBurstSize=1000;
+	ctx->NUM_SAMPLES=NUM_SAMPLES_MAX;
+	ctx->RefillFillPercent=50;
+	ctx->FREQ_MINI_TIMING=DEFAULT_FREQ_MINI_TIMING;
+	ctx->PWMF_MARGIN=DEFAULT_PWMF_MARGIN;
+	ctx->HarmonicNumber=1;
+	ctx->ShowInfo=1;
+	ctx->PwmPatternNbStep[0]=ctx->PwmPatternNbStep[1]=-1;
+	ctx->PwmPatternMargin[0]=ctx->PwmPatternMargin[1]=-1;
+	ctx->CalibMode=CALIB_CHECK;
+	ctx->CalibFile=CALIB_CACHE_FILE;
+	ctx->Stat=StatOpen(RPITX_STAT_NAME);
+
+	if(!Backend->InitGpio()) fatal("Failed to init %s peripherals\n",Backend->Name);
+	if(!Backend->InitDma(terminate, skipSignals)) fatal("Failed to init %s DMA\n",Backend->Name);
 	if(SetDma) DMA_CHANNEL=SetDma;
-	SetupGpioClock(SampleRate,TuningFrequency);
-//int FREQ_MINI_TIMING=157;
-//int PWMF_MARGIN = 1120; //A Margin for now at 1us with PCM ->OK
+	SignalCtx=ctx;
+	return ctx;
+}
 
-	if(CalibrateSystem(&globalppmpll,&PWMF_MARGIN,&FREQ_MINI_TIMING))
-		printf("Calibrate : ppm=%d DMA %dns:%dns\n",globalppmpll,FREQ_MINI_TIMING,PWMF_MARGIN);
+void pitx_close(pitx_ctx *ctx)
+{
+	if(ctx==NULL) return;
+	if(SignalCtx!=ctx)
+	{
+		fprintf(stderr,"pitx_close : context is not open\n");
+		return;
+	}
+	SignalCtx=NULL;
+	Backend->Release();
+	StatClose(ctx->Stat);
+	free(ctx->Staging);
+	free(ctx);
+}
+
+static void pitx_init(pitx_ctx *ctx,int SampleRate, double TuningFrequency)
+{	
+	SetupGpioClock(ctx,SampleRate,TuningFrequency);
+
+	// Calibrate once by context, render output does not depend on the board
+	if((ctx->RenderFileName!=NULL)||ctx->Calibrated) return;
+	// Only the read time is measured : smallest slots, FrequencyTab reads run over the next (zero) slots
+	SetupDmaArena(ctx,1,0);
+	CalibKey(ctx->CalibKey,sizeof(ctx->CalibKey),Backend->Name,DMA_CHANNEL,(ctx->UsePCMClk==0)?18:4);
+	if(!CalibrateFromCache(ctx)&&CalibrateSystem(ctx,&ctx->globalppmpll,&ctx->PWMF_MARGIN,&ctx->FREQ_MINI_TIMING))
+	{
+		printf("Calibrate : ppm=%d DMA %dns:%dns\n",ctx->globalppmpll,ctx->FREQ_MINI_TIMING,ctx->PWMF_MARGIN);
+		if(ctx->CalibMode==CALIB_FULL) CalibrateTimingTable(ctx);
+		CalibStore(ctx);
+	}
+	ctx->Calibrated=1;
 	//printf("Timing : 1 cyle=%dns 1sample=%dns\n",NBSAMPLES_PWM_FREQ_MAX*400*3,(int)(1e9/(float)SampleRate));
-	return 1;
+}
+
+static int64_t RealTimeNs(void)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_REALTIME,&Now);
+	return Now.tv_sec*1000000000LL+Now.tv_nsec;
+}
+
+// --start-at : Unix time (s, decimals allowed), +s from now or :s next multiple of s seconds. 0 on error
+static int64_t ParseStartAt(const char *Text)
+{
+	int64_t Now=RealTimeNs();
+	char *End;
+	double Seconds;
+
+	if(Text[0]==':')
+	{
+		long Period=strtol(Text+1,&End,10);
+		if((*End!=0)||(Period<=0)) return 0;
+		return (Now/1000000000LL/Period+1)*Period*1000000000LL;
+	}
+	Seconds=strtod(Text+(Text[0]=='+'),&End);
+	if((*End!=0)||(End==Text+(Text[0]=='+'))||(Seconds<0)) return 0;
+	if(Text[0]=='+') return Now+(int64_t)(Seconds*1e9);
+	return (int64_t)(Seconds*1e9);
 }
 
 void print_usage(void)
@@ -759,6 +1148,7 @@ fprintf(stderr,\
 Usage:\nrpitx [-i File Input][-m ModeInput] [-f frequency output] [-s Samplerate] [-l] [-p ppm] [-h] \n\
 -m            {IQ(FileInput is a Stereo Wav contains I on left Channel, Q on right channel)}\n\
               {IQFLOAT(FileInput is a Raw float interlaced I,Q)}\n\
+              {CU8, CS8(FileInput is raw unsigned/signed 8 bit interlaced I,Q), CS16 (same as IQ), CF32 (same as IQFLOAT)}\n\
               {RF(FileInput is a (double)Frequency,Time in nanoseconds}\n\
        	      {RFA(FileInput is a (double)Frequency,(int)Time in nanoseconds,(float)Amplitude}\n\
 	      {VFO (constant frequency)}\n\
@@ -767,56 +1157,86 @@ Usage:\nrpitx [-i File Input][-m ModeInput] [-f frequency output] [-s Samplerate
 -l            loop mode for file input\n\
 -p float      frequency correction in parts per million (ppm), positive or negative, for calibration, default 0.\n\
 -d int 	      DMABurstSize (default 1000) but for very short message, could be decrease\n\
+-e int        emulate DMA in memory (no hardware access) with int ns by control block\n\
+--render file write every encoded sample to file as fast as possible (no DMA, no hardware)\n\
+--render-samples n  stop the render after n samples (default : end of input), required with -m VFO and -l\n\
+--fill int    refill when DMA buffer falls to int %% (default 50), lower uses less CPU but less margin\n\
+--listen addr receive framed IQ/RF streams on unix:path or tcp:port (127.0.0.1) instead of -i\n\
+--jitter ms   stream buffered before starting and after an underrun (default 100), -s gives the record rate\n\
+--underrun p  on stream underrun : off (carrier off, default) or hold (repeat last sample)\n\
+--dma-rate n  resample IQ input (-s) to n samples/s for DMA (default : -s, raised for slow rates)\n\
+--calib m     DMA calibration cache (%s) : check (default, quick measure), trust or measure (always)\n\
+              full : measure with the timing table of every step count (exact IQ/RF sample durations)\n\
+--double-buffer DMA writes a flag after each burst (-d), refill waits for it instead of reading the CB position\n\
+--start-at t  Start the DMA at Unix time t (s, may have decimals), +t seconds from now or :t next multiple of t s (:60 next minute)\n\
 -h            help (this help).\n\
 \n",\
-PROGRAM_VERSION);
+PROGRAM_VERSION,CALIB_CACHE_FILE);
 
 } /* end function print_usage */
 
 
 
-double GlobalTuningFrequency;
-int HarmonicNumber =1;
-
-int pitx_SetTuneFrequency(double Frequency)
+static int pitx_SetTuneFrequency(pitx_ctx *ctx,double Frequency)
 {
 	#define MAX_HARMONIC 41
 	int harmonic;
 	
 	if(Frequency<PLL_FREQ_1GHZ/2048L) //2/4096-> For very Low Frequency we used 19.2 MHZ PLL 
 	{
-		PllUsed=PllFreq19MHZ;
-		PllNumber=PLL_192;
+		ctx->PllUsed=ctx->PllFreq19MHZ;
+		ctx->PllNumber=PLL_192;
 	}
 	else 
 	{
-		PllUsed=PllFreq1GHZ;
-		PllNumber=PLL_1GHZ;
+		ctx->PllUsed=ctx->PllFreq1GHZ;
+		ctx->PllNumber=PLL_1GHZ;
 	}
 	
-	printf("Master PLL = %d\n",PllUsed);
+	printf("Master PLL = %d\n",ctx->PllUsed);
 		
 	for(harmonic=1;harmonic<MAX_HARMONIC;harmonic+=2)
 	{
 		//printf("->%lf harmonic %d\n",(TuneFrequency/(double)harmonic),harmonic);
-		if((Frequency/(double)harmonic)<=(double)PllUsed/4.0) break;
+		if((Frequency/(double)harmonic)<=(double)ctx->PllUsed/4.0) break;
 	}
-	HarmonicNumber=harmonic;	
+	ctx->HarmonicNumber=harmonic;	
 
-	//HarmonicNumber=11; //TEST
+	//ctx->HarmonicNumber=11; //TEST
 
-	if(HarmonicNumber>1) //Use Harmonic
+	if(ctx->HarmonicNumber>1) //Use Harmonic
 	{
-		GlobalTuningFrequency=Frequency/HarmonicNumber;			
-		printf("\n Warning : Using harmonic %d\n",HarmonicNumber);
+		ctx->GlobalTuningFrequency=Frequency/ctx->HarmonicNumber;			
+		printf("\n Warning : Using harmonic %d\n",ctx->HarmonicNumber);
 	}
 	else
 	{
-		GlobalTuningFrequency=Frequency;
+		ctx->GlobalTuningFrequency=Frequency;
 	}
 	return 1;
 }
 
+// Bytes of one input record, 0 for modes without input
+static size_t InputRecordSize(char Mode)
+{
+	switch(Mode)
+	{
+	case MODE_IQ: return 2*sizeof(short);
+	case MODE_IQ_FLOAT: return 2*sizeof(float);
+	case MODE_IQ_CU8:
+	case MODE_IQ_CS8: return 2*sizeof(uint8_t);
+	case MODE_RF:
+	case MODE_RFA: return sizeof(samplerf_t);
+	}
+	return 0;
+}
+
+// IQ records converted to Frequency/Amplitude (may be resampled to the DMA rate)
+static inline int IsIQMode(char Mode)
+{
+	return (Mode==MODE_IQ)||(Mode==MODE_IQ_FLOAT)||(Mode==MODE_IQ_CU8)||(Mode==MODE_IQ_CS8);
+}
+
 /** Wrapper around read. */
 static ssize_t readFile(void *buffer, const size_t count) 
 {
@@ -837,9 +1257,53 @@ int main(int argc, char* argv[])
 	float ppmpll=0.0;
 	char NoUsePwmFrequency=0;
 	int SetDma=0;
+	int DmaSampleBurstSize=1000;
+	int NUM_SAMPLES=NUM_SAMPLES_MAX;
+	int UsePCMClk=0;
+	int Randomize=0;
+	unsigned char loop_mode_flag=0;
+	int useStdin=0;
+	char *RenderFileName=NULL;
+	uint64_t RenderSamples=0;
+	int RefillFillPercent=50;
+	mapinput_t InputMap={0};
+	mapinput_t *MappedInput=NULL;
+	char *ListenAddress=NULL;
+	int JitterMs=100;
+	int UnderrunPolicy=UNDERRUN_OFF;
+	int DmaRate=0;
+	int DoubleBuffer=0;
+	int CalibMode=CALIB_CHECK;
+	int64_t StartAt=0;
+	streaminput_t *Stream=NULL;
+	pitx_ctx *ctx;
+	int Result;
+	#define OPT_RENDER 256
+	#define OPT_FILL 257
+	#define OPT_LISTEN 258
+	#define OPT_JITTER 259
+	#define OPT_UNDERRUN 260
+	#define OPT_DMA_RATE 261
+	#define OPT_DOUBLE_BUFFER 262
+	#define OPT_CALIB 263
+	#define OPT_START_AT 264
+	#define OPT_RENDER_SAMPLES 265
+	static struct option long_options[] = {
+		{"render", required_argument, NULL, OPT_RENDER},
+		{"fill", required_argument, NULL, OPT_FILL},
+		{"listen", required_argument, NULL, OPT_LISTEN},
+		{"jitter", required_argument, NULL, OPT_JITTER},
+		{"underrun", required_argument, NULL, OPT_UNDERRUN},
+		{"dma-rate", required_argument, NULL, OPT_DMA_RATE},
+		{"double-buffer", no_argument, NULL, OPT_DOUBLE_BUFFER},
+		{"calib", required_argument, NULL, OPT_CALIB},
+		{"start-at", required_argument, NULL, OPT_START_AT},
+		{"render-samples", required_argument, NULL, OPT_RENDER_SAMPLES},
+		{NULL, 0, NULL, 0}
+	};
 	while(1)
 	{
-		a = getopt(argc, argv, "i:f:m:s:p:hld:w:c:ra:");
+		a = getopt_long(argc, argv, "i:f:m:s:p:hld:w:c:ra:e:", long_options, NULL);
 	
 		if(a == -1) 
 		{
@@ -856,11 +1320,15 @@ int main(int argc, char* argv[])
 		case 'f': // Frequency
 			SetFrequency = atof(optarg);
 			break;
-		case 'm': // Mode (IQ,IQFLOAT,RF,RFA)
+		case 'm': // Mode (IQ,IQFLOAT,RF,RFA,CU8,CS8)
 			if(strcmp("IQ",optarg)==0) Mode=MODE_IQ;
+			if(strcmp("CS16",optarg)==0) Mode=MODE_IQ; // Same layout as IQ, no header skipped
 			if(strcmp("RF",optarg)==0) Mode=MODE_RF;	
 			if(strcmp("RFA",optarg)==0) Mode=MODE_RFA;
 			if(strcmp("IQFLOAT",optarg)==0) Mode=MODE_IQ_FLOAT;
+			if(strcmp("CF32",optarg)==0) Mode=MODE_IQ_FLOAT;
+			if(strcmp("CU8",optarg)==0) Mode=MODE_IQ_CU8;
+			if(strcmp("CS8",optarg)==0) Mode=MODE_IQ_CS8;
 			if(strcmp("VFO",optarg)==0) Mode=MODE_VFO;
 			break;
 		case 's': // SampleRate (Only needeed in IQ mode)
@@ -902,6 +1370,52 @@ int main(int argc, char* argv[])
 			 else
 				SetDma=0;
 			break;
+		case OPT_RENDER: // Offline render to file
+			RenderFileName = optarg;
+			Backend=&BackendEmulator; // Only for the control block memory
+			break;
+		case OPT_FILL: // DMA buffer level (%) which wakes up the refill
+			RefillFillPercent = atoi(optarg);
+			if((RefillFillPercent<0)||(RefillFillPercent>100)) RefillFillPercent=50;
+			break;
+		case OPT_LISTEN: // Streaming server instead of file input
+			ListenAddress = optarg;
+			break;
+		case OPT_JITTER: // Stream buffered before starting (ms)
+			JitterMs = atoi(optarg);
+			if(JitterMs<0) JitterMs=100;
+			break;
+		case OPT_UNDERRUN: // What to send when the stream runs dry
+			if(strcmp(optarg,"off")==0) UnderrunPolicy=UNDERRUN_OFF;
+			else if(strcmp(optarg,"hold")==0) UnderrunPolicy=UNDERRUN_HOLD;
+			else fatal("Unknown underrun policy %s (off or hold)\n",optarg);
+			break;
+		case OPT_DMA_RATE: // IQ resampled to this rate
+			DmaRate = atoi(optarg);
+			if(DmaRate<0) DmaRate=0;
+			break;
+		case OPT_DOUBLE_BUFFER: // Refill on burst completion flags
+			DoubleBuffer=1;
+			break;
+		case OPT_CALIB: // Use of the calibration cache
+			if(strcmp(optarg,"measure")==0) CalibMode=CALIB_MEASURE;
+			else if(strcmp(optarg,"check")==0) CalibMode=CALIB_CHECK;
+			else if(strcmp(optarg,"trust")==0) CalibMode=CALIB_TRUST;
+			else if(strcmp(optarg,"full")==0) CalibMode=CALIB_FULL;
+			else fatal("Unknown calibration mode %s (measure, check, trust or full)\n",optarg);
+			break;
+		case OPT_RENDER_SAMPLES: // Render length (endless inputs)
+			RenderSamples=strtoull(optarg,NULL,10);
+			if(RenderSamples==0) fatal("Bad render length %s\n",optarg);
+			break;
+		case OPT_START_AT: // Timed start (DCF77, beacons)
+			StartAt=ParseStartAt(optarg);
+			if(StartAt==0) fatal("Bad start time %s (Unix time, +seconds or :period)\n",optarg);
+			break;
+		case 'e': // Emulated DMA (benchmark/profiling without hardware)
+			Backend=&BackendEmulator;
+			EmulatorSetTiming(atoi(optarg),-1);
+			break;
         	case -1:
         	break;
 		case '?':
@@ -924,8 +1438,19 @@ int main(int argc, char* argv[])
 		}/* end switch a */
 	}/* end while getopt() */
 
+	// VFO and loop mode never end : the render would fill the disk
+	if((RenderFileName!=NULL)&&(RenderSamples==0)&&((Mode==MODE_VFO)||loop_mode_flag))
+		fatal("--render of -m VFO or -l needs --render-samples\n");
+
 	//Open File Input for modes which need it
-	if((Mode==MODE_IQ)||(Mode==MODE_IQ_FLOAT)||(Mode==MODE_RF)||(Mode==MODE_RFA))
+	if((InputRecordSize(Mode)!=0)&&(ListenAddress!=NULL))
+	{
+		size_t RecordSize=InputRecordSize(Mode);
+		Stream=StreamOpen(ListenAddress,RecordSize,(size_t)JitterMs*SampleRate/1000*RecordSize,UnderrunPolicy);
+		if(Stream==NULL) fatal("Failed to listen on %s (unix:path or tcp:port)\n",ListenAddress);
+		printf("Listening on %s\n",ListenAddress);
+	}
+	else if(InputRecordSize(Mode)!=0)
 	{
 		if(FileName && strcmp(FileName,"-")==0)
 		{
@@ -940,7 +1465,417 @@ int main(int argc, char* argv[])
 	}
 
 	resetFile();
-	return pitx_run(Mode, SampleRate, SetFrequency, ppmpll, NoUsePwmFrequency, readFile, resetFile, NULL,SetDma);
+	// Regular file : zero copy input from a mapping, read() for pipes and stdin
+	if((FileInHandle>=0)&&(!useStdin))
+	{
+		// RF : .ft v2 records are variable length, map every byte
+		size_t RecordSize=((Mode==MODE_RF)||(Mode==MODE_RFA))?1:InputRecordSize(Mode);
+		if(MapInputOpen(&InputMap,FileInHandle,RecordSize)) MappedInput=&InputMap;
+	}
+	ctx=pitx_open(NULL,SetDma);
+	if(ctx==NULL) fatal("Failed to allocate context\n");
+	ctx->DmaSampleBurstSize=DmaSampleBurstSize;
+	ctx->NUM_SAMPLES=NUM_SAMPLES;
+	ctx->UsePCMClk=UsePCMClk;
+	ctx->Randomize=Randomize;
+	ctx->loop_mode_flag=loop_mode_flag;
+	ctx->useStdin=useStdin;
+	ctx->RenderFileName=RenderFileName;
+	ctx->RenderSamples=RenderSamples;
+	ctx->RefillFillPercent=RefillFillPercent;
+	ctx->InputMap=MappedInput;
+	ctx->Stream=Stream;
+	ctx->DmaRate=DmaRate;
+	ctx->DoubleBuffer=DoubleBuffer;
+	ctx->CalibMode=CalibMode;
+	ctx->StartAt=StartAt;
+	Result=pitx_run_ctx(ctx, Mode, SampleRate, SetFrequency, ppmpll, NoUsePwmFrequency, readFile, resetFile);
+	pitx_close(ctx);
+	MapInputClose(&InputMap);
+	if(Stream!=NULL) StreamClose(Stream);
+	if (FileInHandle != -1) close(FileInHandle);
+	return Result;
+}
+
+// ************************* INPUT/DSP THREAD *************************
+// Read input, convert it to Frequency/Amplitude/Duration by DMA slot and push
+// them in the ring. The refill loop (pitx_run) only encodes slots.
+
+// Input state of one pitx_run_ctx
+typedef struct {
+	pitx_ctx *ctx;
+	char Mode;
+	int SampleRate;
+	ssize_t (*readWrapper)(void *buffer, size_t count);
+	void (*reset)(void);
+	txring_t *Ring;
+
+	//Specific to IQ modes : raw records of the mode (burst, or chunk when resampling)
+	void *IQRawArray;
+	//Resampling to the DMA rate (Resampler.Coef NULL : input is at the DMA rate)
+	resampler_t Resampler;
+	int ResampleChunk; // Input samples read at once
+	float *IQFloat; // Chunk converted to float
+	float *Resampled; // Output not sent yet, at most one burst plus one chunk
+	int ResampledCount;
+	//IQ converted by burst to Frequency/Amplitude
+	float *FreqArray;
+	int *AmpArray;
+	float PrevPhase;
+
+	//Specific to Mode RF
+	uint32_t TimeRemaining;
+	samplerf_t SampleRf;
+	blockinput_t Block; // read() path : RF and IQ records are read by blocks
+	int FtVersion; // 0 : start of input, format not known yet
+	ftdecoder_t Ft; // v2 state
+
+	txsample_t LastSample; // Last slot sent, repeated on stream underrun (hold)
+	int Stop; // Set by the refill loop when it ends before the input (render length)
+} txinput_t;
+
+static inline void SetTxSample(txsample_t *Sample,double Frequency,uint32_t Amplitude,uint32_t WaitNanoSecond)
+{
+	Sample->Frequency=Frequency;
+	Sample->Amplitude=Amplitude;
+	Sample->WaitNanoSecond=WaitNanoSecond;
+}
+
+// Mapped input : next Count bytes (Scratch only used across the end of file), NULL at end
+static const void *InputMapped(txinput_t *In,size_t Count,void *Scratch)
+{
+	pitx_ctx *ctx=In->ctx;
+	int Wraps=0;
+	const void *Data=MapInputNext(ctx->InputMap,Count,ctx->loop_mode_flag==1,Scratch,&Wraps);
+
+	if(Data==NULL)
+	{
+		if(MapInputLeft(ctx->InputMap)>0) StatAdd(&ctx->Stat->ShortReads,1);
+		return NULL;
+	}
+	if(Wraps>0)
+	{
+		if((In->Mode!=MODE_RF)&&(In->Mode!=MODE_RFA)) printf("Looping FileIn\n");
+		StatAdd(&ctx->Stat->LoopRestarts,Wraps);
+	}
+	return Data;
+}
+
+// Stream ran dry : carrier off or repeat the last sample
+static void UnderrunSample(txinput_t *In,txsample_t *Sample,uint32_t WaitNanoSecond)
+{
+	pitx_ctx *ctx=In->ctx;
+	if((ctx->Stream->Underrun==UNDERRUN_HOLD)&&(In->LastSample.WaitNanoSecond!=0))
+		SetTxSample(Sample,In->LastSample.Frequency,In->LastSample.Amplitude,WaitNanoSecond);
+	else
+		SetTxSample(Sample,ctx->GlobalTuningFrequency/ctx->HarmonicNumber,0,WaitNanoSecond);
+}
+
+static void StreamStat(pitx_ctx *ctx)
+{
+	streaminput_t *Stream=ctx->Stream;
+	StatSet(&ctx->Stat->StreamClients,__atomic_load_n(&Stream->Clients,__ATOMIC_RELAXED));
+	StatSet(&ctx->Stat->StreamLevel,StreamLevel(Stream));
+	StatSet(&ctx->Stat->StreamTarget,Stream->Target);
+	StatSet(&ctx->Stat->StreamPriming,Stream->Priming);
+	StatSet64(&ctx->Stat->StreamFrames,__atomic_load_n(&Stream->Frames,__ATOMIC_RELAXED));
+	StatSet64(&ctx->Stat->StreamBytes,__atomic_load_n(&Stream->Bytes,__ATOMIC_RELAXED));
+	StatSet64(&ctx->Stat->StreamUnderruns,__atomic_load_n(&Stream->Underruns,__ATOMIC_RELAXED));
+}
+
+// Whole burst of underrun samples (IQ modes)
+static int InputUnderrun(txinput_t *In,uint32_t WaitNanoSecond)
+{
+	pitx_ctx *ctx=In->ctx;
+	int i;
+	for(i=0;i<ctx->DmaSampleBurstSize;i++)
+		UnderrunSample(In,RingWriteSlot(In->Ring,i),WaitNanoSecond);
+	StreamStat(ctx);
+	RingCommit(In->Ring,ctx->DmaSampleBurstSize);
+	return 1;
+}
+
+// DMA sample rate of an IQ input : --dma-rate, else the input rate raised by an integer
+// factor while one sample would last more than PWM_STEP_MAXI steps of FREQ_MINI_TIMING
+static int DmaSampleRate(pitx_ctx *ctx,int SampleRate)
+{
+	int MinRate;
+
+	if(ctx->DmaRate!=0) return ctx->DmaRate;
+	MinRate=(1000000000+PWM_STEP_MAXI*ctx->FREQ_MINI_TIMING-1)/(PWM_STEP_MAXI*ctx->FREQ_MINI_TIMING);
+	if(SampleRate>=MinRate) return SampleRate;
+	return SampleRate*((MinRate+SampleRate-1)/SampleRate);
+}
+
+// Next Count IQ records in *IQRaw (IQRawArray, the mapping or the block reader), STREAM_DATA/UNDERRUN/END
+static int InputIQRaw(txinput_t *In,int Count,const void **IQRaw)
+{
+	pitx_ctx *ctx=In->ctx;
+	const size_t Bytes=Count*InputRecordSize(In->Mode);
+	int Status;
+
+	*IQRaw=In->IQRawArray;
+	if(ctx->Stream!=NULL)
+		return StreamRead(ctx->Stream,In->IQRawArray,Bytes);
+	if(ctx->InputMap!=NULL)
+	{
+		*IQRaw=InputMapped(In,Bytes,In->IQRawArray);
+		return (*IQRaw==NULL)?STREAM_END:STREAM_DATA;
+	}
+	// read() path : a whole burst or nothing (a pipe returns what is available)
+	*IQRaw=BlockInputNext(&In->Block,Bytes,&Status);
+	if(*IQRaw!=NULL) return STREAM_DATA;
+	if(Status==BLOCK_INPUT_SHORT) StatAdd(&ctx->Stat->ShortReads,1);
+	if(ctx->loop_mode_flag!=1) return STREAM_END;
+	printf("Looping FileIn\n");
+	StatAdd(&ctx->Stat->LoopRestarts,1);
+	In->reset();
+	BlockInputReset(&In->Block);
+	// IQ restarts with the first records
+	*IQRaw=BlockInputNext(&In->Block,Bytes,&Status);
+	return (*IQRaw==NULL)?STREAM_END:STREAM_DATA;
+}
+
+// Next RF/RFA record from the mapping or the block reader, .ft v1 or v2 (detected at start of input)
+// 0 at end of input, rewound first when looping
+static int InputRfRecord(txinput_t *In,samplerf_t *SampleRf)
+{
+	pitx_ctx *ctx=In->ctx;
+	int Rewound=0;
+
+	for(;;)
+	{
+		size_t Avail;
+		const uint8_t *Data;
+		int Used;
+
+		if(ctx->InputMap!=NULL)
+			Data=MapInputPeek(ctx->InputMap,&Avail);
+		else
+			Data=BlockInputPeek(&In->Block,FT_RECORD_MAX,&Avail);
+		if(In->FtVersion==0)
+		{
+			// Start of input : skip the v2 header, then read the first record
+			Used=FtHeaderCheck(&In->Ft,Data,Avail);
+			if(Used<0) fatal("Unsupported or truncated .ft header\n");
+			if((Used>0)&&(!Rewound))
+			{
+				const ftheader_t *Header=&In->Ft.Header;
+				// pifsq, pisstv and pidcf77 records have no fixed rate (SampleRate 0)
+				if(Header->SampleRate>0)
+					printf("RF input : .ft v2, %d records/s\n",Header->SampleRate);
+				else
+					printf("RF input : .ft v2\n");
+				if((Header->Mode==FT_MODE_RFA)!=(In->Mode==MODE_RFA))
+					printf("Warning : file is made for %s mode\n",(Header->Mode==FT_MODE_RFA)?"RFA":"RF");
+			}
+			In->FtVersion=(Used>0)?FT_VERSION_2:FT_VERSION_1;
+			if(ctx->InputMap!=NULL)
+				MapInputSkip(ctx->InputMap,Used);
+			else
+				BlockInputSkip(&In->Block,Used);
+			continue;
+		}
+		else if(In->FtVersion==FT_VERSION_2)
+			Used=FtDecode(&In->Ft,Data,Avail,SampleRf);
+		else if(Avail>=sizeof(samplerf_t))
+		{
+			memcpy(SampleRf,Data,sizeof(samplerf_t));
+			Used=sizeof(samplerf_t);
+		}
+		else
+			Used=-1;
+
+		if(Used>=0)
+		{
+			if(ctx->InputMap!=NULL)
+				MapInputSkip(ctx->InputMap,Used);
+			else
+				BlockInputSkip(&In->Block,Used);
+			return 1;
+		}
+
+		// End of input, a partial record is dropped
+		if(Avail>0) StatAdd(&ctx->Stat->ShortReads,1);
+		if((ctx->loop_mode_flag!=1)||Rewound) return 0;
+		StatAdd(&ctx->Stat->LoopRestarts,1);
+		if(ctx->InputMap!=NULL)
+			MapInputRewind(ctx->InputMap);
+		else
+		{
+			In->reset();
+			BlockInputReset(&In->Block);
+		}
+		In->FtVersion=0;
+		Rewound=1;
+	}
+}
+
+// Fill DmaSampleBurstSize slots from the input, return 0 at end of input
+static int InputBurst(txinput_t *In)
+{
+	pitx_ctx *ctx=In->ctx;
+	const char Mode=In->Mode;
+	const int SampleRate=In->SampleRate;
+	txring_t *Ring=In->Ring;
+	int i;
+	int OffsetModulation=1000;//TBR
+	int Clips=0;
+
+	float *FreqArray=In->FreqArray;
+	int *AmpArray=In->AmpArray;
+
+// *************************************** MODE IQ, IQ FLOAT, CU8, CS8 **************************************************
+	if(IsIQMode(Mode))
+	{
+		const uint32_t WaitNanoSecond=1e9/SampleRate;
+		const int Burst=ctx->DmaSampleBurstSize;
+		const void *IQRaw;
+		int Status;
+		if(In->Resampler.Coef==NULL)
+		{
+			Status=InputIQRaw(In,Burst,&IQRaw);
+			if(Status==STREAM_END) return 0;
+			if(Status==STREAM_UNDERRUN) return InputUnderrun(In,WaitNanoSecond);
+			if(Mode==MODE_IQ)
+				Clips=IQToFreqAmpBlock(IQRaw,Burst,SampleRate,&In->PrevPhase,FreqArray,AmpArray);
+			else if(Mode==MODE_IQ_FLOAT)
+				Clips=IQFloatToFreqAmpBlock(IQRaw,Burst,SampleRate,&In->PrevPhase,FreqArray,AmpArray);
+			else
+				Clips=IQ8ToFreqAmpBlock(IQRaw,Burst,Mode==MODE_IQ_CU8,SampleRate,&In->PrevPhase,FreqArray,AmpArray);
+		}
+		else
+		{
+			// Resampled to the DMA rate : input is read by chunks until a whole burst is out
+			while(In->ResampledCount<Burst)
+			{
+				const float *IQFloat=In->IQFloat;
+				Status=InputIQRaw(In,In->ResampleChunk,&IQRaw);
+				if(Status==STREAM_END) return 0;
+				if(Status==STREAM_UNDERRUN) return InputUnderrun(In,WaitNanoSecond);
+				if(Mode==MODE_IQ)
+					IQ16ToFloat(IQRaw,In->ResampleChunk,In->IQFloat);
+				else if(Mode==MODE_IQ_FLOAT)
+					IQFloat=IQRaw;
+				else
+					IQ8ToFloat(IQRaw,In->ResampleChunk,Mode==MODE_IQ_CU8,In->IQFloat);
+				In->ResampledCount+=ResamplerProcess(&In->Resampler,IQFloat,In->ResampleChunk,In->Resampled+2*In->ResampledCount);
+			}
+			Clips=IQFloatToFreqAmpBlock(In->Resampled,Burst,SampleRate,&In->PrevPhase,FreqArray,AmpArray);
+			In->ResampledCount-=Burst;
+			memmove(In->Resampled,In->Resampled+2*Burst,In->ResampledCount*2*sizeof(float));
+		}
+		if(Mode==MODE_IQ)
+		{
+			for(i=0;i<Burst;i++)
+			{
+				int amp=AmpArray[i];
+				double df=FreqArray[i];
+				
+				// Compression have to be done in modulation (SSB not here)
+				double A = 87.7f; // compression parameter
+				double ampf=amp/32767.0;
+				ampf = (fabs(ampf) < 1.0f/A) ? A*fabs(ampf)/(1.0f+ln(A)) : (1.0f+ln(A*fabs(ampf)))/(1.0f+ln(A)); //compand
+				amp= (int)(round(ampf * 32767.0f)) ;
+
+				// FIXME : df/harmonicNumber could alterate maybe modulations
+				SetTxSample(RingWriteSlot(Ring,i),(ctx->GlobalTuningFrequency-OffsetModulation+df/ctx->HarmonicNumber)/ctx->HarmonicNumber,amp,WaitNanoSecond);
+			}
+		}
+		else
+		{
+			for(i=0;i<Burst;i++)
+			{
+				//if(df>SampleRate/2) df=SampleRate/2-df;
+				SetTxSample(RingWriteSlot(Ring,i),(ctx->GlobalTuningFrequency-OffsetModulation+FreqArray[i]/ctx->HarmonicNumber)/ctx->HarmonicNumber,AmpArray[i],WaitNanoSecond);
+			}
+		}
+	}
+// *************************************** MODE RF **************************************************
+	if((Mode==MODE_RF)||(Mode==MODE_RFA))
+	{
+		// SHOULD NOT EXEED 200 STEP*500ns; SAMPLERATE SHOULD BE MAX TO HAVE PRECISION FOR PCM 
+		// BUT FIFO OF PCM IS 16 : SAMPLERATE MAYBE NOT EXCESS 16*80000 ! CAREFULL BUGS HERE
+		uint32_t TimeRemaining=In->TimeRemaining;
+		samplerf_t SampleRf=In->SampleRf;
+		for(i=0;i<ctx->DmaSampleBurstSize;i++)
+		{
+			if(TimeRemaining==0)
+			{
+				if(ctx->Stream!=NULL)
+				{
+					int Status=StreamRead(ctx->Stream,&SampleRf,sizeof(samplerf_t));
+					if(Status==STREAM_END) return 0;
+					if(Status==STREAM_UNDERRUN)
+					{
+						UnderrunSample(In,RingWriteSlot(Ring,i),1e9/SampleRate);
+						continue;
+					}
+				}
+				else if(!InputRfRecord(In,&SampleRf))
+					return 0;
+					
+				TimeRemaining=SampleRf.WaitForThisSample;
+				//printf("A=%f Time =%d \n",SampleRf.Frequency,SampleRf.WaitForThisSample);
+			}
+			
+			int amp=32767;
+			int WaitSample;
+			
+			if(TimeRemaining>MAX_DELAY_WAIT) 
+				WaitSample=MAX_DELAY_WAIT;	
+			else
+				WaitSample=TimeRemaining;
+			
+			if(Mode==MODE_RF)
+			{
+				if(SampleRf.Frequency==0.0)
+					amp=0;
+				SetTxSample(RingWriteSlot(Ring,i),(SampleRf.Frequency/ctx->HarmonicNumber+ctx->GlobalTuningFrequency)/ctx->HarmonicNumber,amp,WaitSample);
+			}
+			if(Mode==MODE_RFA)
+				SetTxSample(RingWriteSlot(Ring,i),(ctx->GlobalTuningFrequency)/ctx->HarmonicNumber,SampleRf.Frequency,WaitSample);
+
+			TimeRemaining-=WaitSample;
+		}
+		In->TimeRemaining=TimeRemaining;
+		In->SampleRf=SampleRf;
+	}
+		
+// *************************************** MODE VFO **************************************************
+	if(Mode==MODE_VFO)
+	{
+		for(i=0;i<ctx->DmaSampleBurstSize;i++)
+			SetTxSample(RingWriteSlot(Ring,i),ctx->GlobalTuningFrequency/ctx->HarmonicNumber,VFO_AMPLITUDE,VFO_SAMPLE_NS);
+	}
+	if(Clips>0)
+	{
+		printf("!"); //Overload
+		StatAdd(&ctx->Stat->Clips,Clips);
+	}
+	if(ctx->Stream!=NULL) StreamStat(ctx);
+	In->LastSample=*RingWriteSlot(Ring,ctx->DmaSampleBurstSize-1);
+	RingCommit(Ring,ctx->DmaSampleBurstSize);
+	return 1;
+}
+
+static void *InputThread(void *arg)
+{
+	txinput_t *In=(txinput_t *)arg;
+	pitx_ctx *ctx=In->ctx;
+	struct timespec Wait={0,200000};
+
+	while(!__atomic_load_n(&In->Stop,__ATOMIC_ACQUIRE))
+	{
+		if(RingSpace(In->Ring)<ctx->DmaSampleBurstSize)
+		{
+			nanosleep(&Wait,NULL); // Refill thread is behind, enough samples ready
+			continue;
+		}
+		if(!InputBurst(In)) break;
+	}
+	RingSetEnd(In->Ring);
+	return NULL;
 }
 
 int pitx_run(
@@ -954,53 +1889,95 @@ int pitx_run(
 	int* skipSignals,
 	int SetDma) 
 {
-	int i;
-	//char pagemap_fn[64];
+	pitx_ctx *ctx=pitx_open(skipSignals,SetDma);
+	int Result;
 
-	int OffsetModulation=1000;//TBR
-	int MicGain=100;
-	//unsigned char *data;
+	if(ctx==NULL) return -1;
+	Result=pitx_run_ctx(ctx,Mode,SampleRate,SetFrequency,ppmpll,NoUsePwmFrequency,readWrapper,reset);
+	pitx_close(ctx);
+	return Result;
+}
 
-	//Specific to ModeIQ
-	static signed short *IQArray=NULL;
+// FrequencyTab words of the longest sample the input thread writes (timing is calibrated)
+static int RunStepMax(pitx_ctx *ctx,char Mode,int SampleRate)
+{
+	uint32_t WaitMax=1e9/SampleRate; // Stream underrun hold
+	int NbStep;
+
+	if(IsIQMode(Mode))
+		WaitMax=1e9/DmaSampleRate(ctx,SampleRate);
+	else if(Mode==MODE_VFO)
+		WaitMax=VFO_SAMPLE_NS;
+	else if(MAX_DELAY_WAIT>WaitMax)
+		WaitMax=MAX_DELAY_WAIT;
+	if(ctx->NbTiming>0)
+		NbStep=TimingFloor(ctx,WaitMax,NULL)+2; // +1 : carried fractions
+	else
+		NbStep=WaitMax/ctx->FREQ_MINI_TIMING+1; // +1 : the resampler may round the DMA rate down
+	return (NbStep>PWM_STEP_MAXI)?PWM_STEP_MAXI:NbStep;
+}
 
-	//Specific to ModeIQ_FLOAT
-	static float *IQFloatArray=NULL;
+// Slot being played : from the CB address, or the burst after the last completion flag (DoubleBuffer)
+static int DmaPlayingSample(pitx_ctx *ctx,const dmapos_t *Pos)
+{
+	if(ctx->DmaDone!=NULL)
+		return ((*ctx->DmaDone+1)%ctx->DmaBursts)*ctx->DmaSampleBurstSize;
+	return DmaCbSlot(Pos);
+}
 
-	//Specific to Mode RF
-	typedef struct {
-		double Frequency;
-		uint32_t WaitForThisSample;
-	} samplerf_t;
-	samplerf_t *TabRfSample=NULL;
+// Sleep until START_SPIN_NS before ctx->StartAt (TIMER_ABSTIME on CLOCK_REALTIME : NTP steps are followed), then spin
+static void WaitStartAt(pitx_ctx *ctx)
+{
+	int64_t Wake=ctx->StartAt-START_SPIN_NS;
+	struct timespec Ts;
+
+	Ts.tv_sec=Wake/1000000000LL;
+	Ts.tv_nsec=Wake%1000000000LL;
+	if(Wake>RealTimeNs())
+		while(clock_nanosleep(CLOCK_REALTIME,TIMER_ABSTIME,&Ts,NULL)==EINTR);
+	while(RealTimeNs()<ctx->StartAt);
+}
+
+int pitx_run_ctx(
+	pitx_ctx *ctx,
+	const char Mode,
+	int SampleRate,
+	const float SetFrequency,
+	float ppmpll,
+	const char NoUsePwmFrequency,
+	ssize_t (*readWrapper)(void *buffer, size_t count),
+	void (*reset)(void))
+{
+	txring_t Ring;
+	txinput_t Input;
+	pthread_t InputThreadId;
+	refill_kernel_t RefillKernel;
 
 	fprintf(stdout,"rpitx Version %s compiled %s (F5OEO Evariste) running on ",PROGRAM_VERSION,__DATE__);
 
 	// Init Plls Frequency using ppm (or default)
-	if(ppmpll!=0) ppmpll=(float)globalppmpll; // Use calibrate only if not setting by user
-	PllFreq500MHZ=PLL_FREQ_500MHZ;
-	PllFreq500MHZ+=PllFreq500MHZ * (ppmpll / 1000000.0);
+	if(ppmpll!=0) ppmpll=(float)ctx->globalppmpll; // Use calibrate only if not setting by user
+	ctx->PllFreq500MHZ=PLL_FREQ_500MHZ;
+	ctx->PllFreq500MHZ+=ctx->PllFreq500MHZ * (ppmpll / 1000000.0);
 
-	PllFreq1GHZ=PLL_FREQ_1GHZ;
-	PllFreq1GHZ+=PllFreq1GHZ * (ppmpll / 1000000.0);
+	ctx->PllFreq1GHZ=PLL_FREQ_1GHZ;
+	ctx->PllFreq1GHZ+=ctx->PllFreq1GHZ * (ppmpll / 1000000.0);
 
-	PllFreq19MHZ=PLLFREQ_192;
-	PllFreq19MHZ+=PllFreq19MHZ * (ppmpll / 1000000.0);
+	ctx->PllFreq19MHZ=PLLFREQ_192;
+	ctx->PllFreq19MHZ+=ctx->PllFreq19MHZ * (ppmpll / 1000000.0);
 
 	//End of Init Plls
 
 	if(Mode==MODE_IQ)
 	{
-		IQArray=malloc(DmaSampleBurstSize*2*sizeof(signed short)); // TODO A FREE AT THE END OF SOFTWARE
-		reset();
-	} 
-	if(Mode==MODE_IQ_FLOAT)
-	{
-		IQFloatArray=malloc(DmaSampleBurstSize*2*sizeof(float)); // TODO A FREE AT THE END OF SOFTWARE
+		if(ctx->InputMap!=NULL)
+			MapInputRewind(ctx->InputMap);
+		else if(ctx->Stream==NULL)
+			reset();
 	}
 	if((Mode==MODE_RF)||(Mode==MODE_RFA))
 	{
-		//TabRfSample=malloc(DmaSampleBurstSize*sizeof(samplerf_t));
+		//TabRfSample=malloc(ctx->DmaSampleBurstSize*sizeof(samplerf_t));
 		SampleRate=50000L; //NOT USED BUT BY CALCULATING TIMETOSLEEP IN RF MODE
 	}
 	if(Mode==MODE_VFO)
@@ -1008,372 +1985,213 @@ int pitx_run(
 
 	if(Mode==MODE_IQ)
 	{
-		printf(" Frequency=%f ",GlobalTuningFrequency);
+		printf(" Frequency=%f ",ctx->GlobalTuningFrequency);
 		printf(" SampleRate=%d ",SampleRate);	
 	}
 
 
 	
 
-	pitx_SetTuneFrequency(SetFrequency*1000.0);
-	pitx_init(SampleRate, GlobalTuningFrequency, skipSignals,SetDma);
-	
-
-	static volatile uint32_t cur_cb,last_cb;
-	int last_sample;
-	int this_sample; 
-	int free_slots;
-	//int SumDelay=0;
+	pitx_SetTuneFrequency(ctx,SetFrequency*1000.0);
+	pitx_init(ctx,SampleRate, ctx->GlobalTuningFrequency);
+	{
+		int Handoff=ctx->DoubleBuffer&&(ctx->RenderFileName==NULL);
+		if(Handoff&&((ctx->NUM_SAMPLES%ctx->DmaSampleBurstSize!=0)||(ctx->NUM_SAMPLES<2*ctx->DmaSampleBurstSize)))
+		{
+			printf("Double buffer needs a DMA ring of 2 whole bursts or more : CB position used\n");
+			Handoff=0;
+		}
+		SetupDmaArena(ctx,RunStepMax(ctx,Mode,SampleRate),Handoff);
+	}
+	if((ctx->RenderFileName!=NULL)&&(!RenderOpen(ctx->RenderFileName)))
+		fatal("Failed to open render file %s\n",ctx->RenderFileName);
+
+	// Encoder specialized for this mode/output, selected once
+	RefillKernel=SelectRefillKernel(ctx,Mode,NoUsePwmFrequency);
+	ResetPwmDither(ctx);
+	ResetSlotSamples(ctx);
+	ctx->TimingWait=0;
+	ctx->TimingCarry=0;
+	if(Mode==MODE_VFO)
+		SetConstantEnvelope(ctx,VFO_AMPLITUDE);
+
+	// Input/DSP thread : ring holds 4 bursts
+	if(!RingInit(&Ring,4*ctx->DmaSampleBurstSize))
+		fatal("Failed to allocate sample ring\n");
+	memset(&Input,0,sizeof(Input));
+	Input.ctx=ctx;
+	Input.Mode=Mode;
+	if(IsIQMode(Mode))
+	{
+		int DmaRate=DmaSampleRate(ctx,SampleRate);
+		if(DmaRate!=SampleRate)
+		{
+			resampler_t *Rs=&Input.Resampler;
+			if(!ResamplerInit(Rs,SampleRate,&DmaRate))
+				fatal("Failed to allocate resampler\n");
+			Input.ResampleChunk=((int64_t)ctx->DmaSampleBurstSize*Rs->M+Rs->L-1)/Rs->L;
+			Input.IQFloat=malloc(Input.ResampleChunk*2*sizeof(float));
+			Input.Resampled=malloc((ctx->DmaSampleBurstSize+ResamplerMaxOutput(Rs,Input.ResampleChunk))*2*sizeof(float));
+			printf("Resampling %d -> %d samples/s (x%d/%d, %d taps by phase)\n",SampleRate,DmaRate,Rs->L,Rs->M,Rs->Taps);
+			SampleRate=DmaRate; // Timing, scheduler and stats are at the DMA rate from now
+		}
+		Input.IQRawArray=malloc(((Input.ResampleChunk>ctx->DmaSampleBurstSize)?Input.ResampleChunk:ctx->DmaSampleBurstSize)*InputRecordSize(Mode));
+	}
+	Input.SampleRate=SampleRate;
+	Input.readWrapper=readWrapper;
+	Input.reset=reset;
+	Input.Ring=&Ring;
+	if(((Mode==MODE_RF)||(Mode==MODE_RFA)||IsIQMode(Mode))&&(ctx->InputMap==NULL)&&(ctx->Stream==NULL))
+	{
+		size_t BlockSize=BLOCK_INPUT_SIZE;
+		if(IsIQMode(Mode))
+		{
+			// At least 2 reads (chunks when resampling) by block
+			size_t ReadBytes=((Input.ResampleChunk>ctx->DmaSampleBurstSize)?Input.ResampleChunk:ctx->DmaSampleBurstSize)*InputRecordSize(Mode);
+			if(BlockSize<2*ReadBytes) BlockSize=2*ReadBytes;
+		}
+		if(!BlockInputInit(&Input.Block,readWrapper,BlockSize))
+			fatal("Failed to allocate input buffer\n");
+	}
+	if(IsIQMode(Mode))
+	{
+		Input.FreqArray=malloc(ctx->DmaSampleBurstSize*sizeof(float));
+		Input.AmpArray=malloc(ctx->DmaSampleBurstSize*sizeof(int));
+	}
+	{
+		// Signals (terminate) must stay on this thread
+		sigset_t All,Old;
+		sigfillset(&All);
+		pthread_sigmask(SIG_BLOCK,&All,&Old);
+		if(pthread_create(&InputThreadId,NULL,InputThread,&Input)!=0)
+			fatal("Failed to start input thread\n");
+		pthread_sigmask(SIG_SETMASK,&Old,NULL);
+	}
 	
-	long int start_time;
-	static long time_difference=0;
-	struct timespec gettime_now;
 
-	cur_cb = (uint32_t)virtbase+ (NUM_SAMPLES-DmaSampleBurstSize)* sizeof(dma_cb_t) *CBS_SIZE_BY_SAMPLE;
-	
-	last_cb=(uint32_t)virtbase /*+ 965* sizeof(dma_cb_t) *CBS_SIZE_BY_SAMPLE*/ ;
+	dmapos_t Pos;
+	InitDmaPos(ctx,&Pos);
 
+	unsigned char Init=1;
 
-	dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]=mem_virt_to_phys((void*)cur_cb);
+	StatAdd(&ctx->Stat->Runs,1);
+	StatSet(&ctx->Stat->NumSamples,ctx->NUM_SAMPLES);
+	StatSet(&ctx->Stat->BurstSize,ctx->DmaSampleBurstSize);
+	StatSet(&ctx->Stat->SampleRate,SampleRate);
+	StatSet(&ctx->Stat->MinHeadroom,ctx->NUM_SAMPLES);
+	StatSet(&ctx->Stat->Running,1);
 
-	unsigned char Init=1;
+	// First guess of DMA speed, then measured from CB position
+	SchedInit(&ctx->RefillSched,ctx->NUM_SAMPLES,ctx->DmaSampleBurstSize,ctx->RefillFillPercent,(Mode==MODE_VFO)?1e9/VFO_SAMPLE_NS:SampleRate);
 
 // -----------------------------------------------------------------
 
 	for (;;) 
 	{
-		int TimeToSleep;
-		static int StatusCompteur=0;
-			
-		cur_cb = mem_phys_to_virt((uint32_t)(dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]));
-		this_sample = (cur_cb - (uint32_t)virtbase) / (sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE);
-		last_sample = (last_cb - (uint32_t)virtbase) / (sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE);
-		free_slots = this_sample - last_sample;
-		if (free_slots < 0) // WARNING : ORIGINAL CODE WAS < strictly
-			free_slots += NUM_SAMPLES;
-				
-		//printf("last_sample %lx cur_cb %lx FreeSlots = %d Time to sleep=%d\n",last_sample,cur_cb,free_slots,TimeToSleep);
-			
-		if(Init==0)
-		{
-			if((Mode==MODE_RF)||(Mode==MODE_RFA))
-			{
-				TimeToSleep=100; //Max 100KHZ
-			}
-			else
-				TimeToSleep=(1e6*(NUM_SAMPLES-free_slots*2))/SampleRate; // Time to sleep in us
-			//printf("TimeToSleep%d\n",TimeToSleep);
-		}
-		else
-			TimeToSleep=1000;
-			
-		//printf("Buffer Available=%d\n",BufferAvailable());
-			
-		clock_gettime(CLOCK_REALTIME, &gettime_now);
-		start_time = gettime_now.tv_nsec;		
-		if(TimeToSleep>=(2200+KERNEL_GRANULARITY)) // 2ms : Time to process File/Canal Coding
-		{
-			udelay(TimeToSleep-(2200+KERNEL_GRANULARITY));
-			TimeToSleep=0;
-		}
-		else
-		{
-			//udelay(TimeToSleep);
-			sched_yield();
-			//TimeToSleep=0;
-			//if(free_slots>(NUM_SAMPLES*9/10))
-			//printf("Buffer nearly empty...%d/%d\n",free_slots,NUM_SAMPLES);
-		}
-			
-		static int free_slots_now;
-		cur_cb = mem_phys_to_virt(dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]);
-		this_sample = (cur_cb - (uint32_t)virtbase) / (sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE);
-		last_sample = (last_cb - (uint32_t)virtbase) / (sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE);
-		free_slots_now = this_sample - last_sample;
-		if (free_slots_now < 0) // WARNING : ORIGINAL CODE WAS < strictly
-			free_slots_now += NUM_SAMPLES;
-			
-		clock_gettime(CLOCK_REALTIME, &gettime_now);
-		time_difference = gettime_now.tv_nsec - start_time;
-		if(time_difference<0) time_difference+=1E9;
-			
-		if(StatusCompteur%10==0)
-		{ 
-			//printf(" DiffTime = %ld FreeSlot %d FreeSlotDiff=%d Bitrate : %f\n",time_difference,free_slots_now,free_slots_now-free_slots,(1e9*(free_slots_now-free_slots))/(float)time_difference);	
-		}
-		//if((1e9*(free_slots_now-free_slots))/(float)time_difference<40100.0) printf("Drift BAD\n"); else printf("Drift GOOD\n");	
-		StatusCompteur++;
-		free_slots=free_slots_now;
-		// FIX IT : Max(freeslot et Numsample/8)
-		if((Init==1)&&(free_slots < DmaSampleBurstSize /*NUM_SAMPLES/8*/))
-		{
-			printf("****** STARTING TRANSMIT ********\n");
-			dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]=mem_virt_to_phys((void*)virtbase );
-			usleep(100);
-			//Start DMA PWMFrequency
-				
-			//dma_reg[DMA_CS+DMA_CHANNEL_PWMFREQUENCY*0x40] = 0x10880001;				
+		int FirstSample;
+		int64_t RefillStart;
 
-			//Start Main DMA
-			dma_reg[DMA_CS+DMA_CHANNEL*0x40] = DMA_CS_PRIORITY(7) | DMA_CS_PANIC_PRIORITY(7) | DMA_CS_DISDEBUG |DMA_CS_ACTIVE;
-			
-				
-			Init=0;
-				
-			continue;
-		}
-		clock_gettime(CLOCK_REALTIME, &gettime_now);
-		start_time = gettime_now.tv_nsec;
-			
-		int debug=0;
-
-		if ((free_slots>=DmaSampleBurstSize)) 
+		if(ctx->RenderFileName!=NULL) // Offline render : one burst per loop, never wait DMA
+			;
+		else if(Init==1)
 		{
-		// *************************************** MODE IQ **************************************************
-			if(Mode==MODE_IQ)
+			// Whole ring refilled but one burst : start from the first slot
+			if(DmaPosQueued(&Pos)>=ctx->NUM_SAMPLES-ctx->DmaSampleBurstSize)
 			{
-				int NbRead=0;
-				static int Max=0;
-				static int Min=32767;
-				static int CompteSample=0;
-				CompteSample++;
-				NbRead=readWrapper(IQArray,DmaSampleBurstSize*2*2/*SHORT I,SHORT Q*/);
-				
-				if(NbRead!=DmaSampleBurstSize*2*2) 
+				printf("****** STARTING TRANSMIT ********\n");
+				dma_reg[DMA_CONBLK_AD+DMA_CHANNEL*0x40]=Pos.Base;
+				if(ctx->DmaDone!=NULL) *ctx->DmaDone=ctx->DmaBursts-1;
+				usleep(100);
+				if(ctx->StartAt!=0)
 				{
-					if(loop_mode_flag==1)
-					{
-						printf("Looping FileIn\n");
-						reset();
-						NbRead=readWrapper(IQArray,DmaSampleBurstSize*2*2);
-					}
-					else {
-						stop_dma();
-						return 0;
-					}
+					int64_t Wait=ctx->StartAt-RealTimeNs();
+					if(Wait<0)
+						printf("Ring primed %.3fs after the start time : starting now\n",-Wait/1e9);
+					else
+						printf("Ring primed, start in %.3fs\n",Wait/1e9);
+					fflush(stdout);
+					WaitStartAt(ctx);
 				}
+				//Start DMA PWMFrequency
 				
-				for(i=0;i<DmaSampleBurstSize;i++)
-				{
-					//static float samplerate=48000;
-					static int amp;
-					static double df;
-					
-					int CorrectionRpiFrequency=-1000; //TODO PPM / Offset=1KHZ at 144MHZ
-					
-					CompteSample++;
-					//printf("i%d q%d\n",IQArray[2*i],IQArray[2*i+1]);
-					
-					IQToFreqAmp(IQArray[2*i+1],IQArray[2*i],&df,&amp,SampleRate);
-						
-					// Compression have to be done in modulation (SSB not here)
-						
-					double A = 87.7f; // compression parameter
-					double ampf=amp/32767.0;
-      				ampf = (fabs(ampf) < 1.0f/A) ? A*fabs(ampf)/(1.0f+ln(A)) : (1.0f+ln(A*fabs(ampf)))/(1.0f+ln(A)); //compand
-					amp= (int)(round(ampf * 32767.0f)) ;
-						
-					if(amp>Max) Max=amp;
-					if(amp<Min) Min=amp;	
-						
-					/*
-					if((CompteSample%4800)==0)
-					{
-						//printf("%d\n",((CompteSample/48000)*1024)%32767);
-						//printf("Amp %d Freq %f MinAmp %d MaxAmp %d\n",amp,df,Min,Max);
-						printf("%d;%d;%d;%f\n",IQArray[2*i+1],IQArray[2*i],amp,df);
-						// printf(".");
-						fflush(stdout);
-					}
-					*/
-					// TEST - WARNING, REMOVE FOR RELEASE 
-					//amp=((CompteSample/48000)*1024)%32767;
-					//df=0;
-					//amp=amp*10;
-					//amp=32767;
-					//if(df<OffsetModulation+100) amp=0;
-					//if(amp<32767/8) df= OffsetModulation;
-					//
-
-					// FIXME : df/harmonicNumber could alterate maybe modulations
-					FrequencyAmplitudeToRegister((GlobalTuningFrequency-OffsetModulation+/*(CompteSample/480)*/+df/HarmonicNumber)/HarmonicNumber,amp,last_sample++,0,SampleRate,NoUsePwmFrequency,CompteSample%2);
-					// !!!!!!!!!!!!!!!!!!!! 680 is for 48KHZ , should be adpated !!!!!!!!!!!!!!!!!
-
-					free_slots--;
-					if (last_sample == NUM_SAMPLES)	last_sample = 0;
-				}
-			}
-		// *************************************** MODE IQ FLOAT**************************************************
-			if(Mode==MODE_IQ_FLOAT)
-			{
-				int NbRead=0;
-				static int Max=0;
-				static int Min=32767;
-				static int CompteSample=0;
-				CompteSample++;
-				NbRead=readWrapper(IQFloatArray,DmaSampleBurstSize*2*sizeof(float));
-				
-				if(NbRead!=DmaSampleBurstSize*2*sizeof(float)) 
+				//dma_reg[DMA_CS+DMA_CHANNEL_PWMFREQUENCY*0x40] = 0x10880001;				
+
+				//Start Main DMA
+				RfOutput(ctx,1);
+				dma_reg[DMA_CS+DMA_CHANNEL*0x40] = DMA_CS_PRIORITY(7) | DMA_CS_PANIC_PRIORITY(7) | DMA_CS_DISDEBUG |DMA_CS_ACTIVE;
+				if(ctx->StartAt!=0)
 				{
-					if(loop_mode_flag==1)
-					{
-						printf("Looping FileIn\n");
-						reset();
-					}
-					else if (!useStdin) {
-						stop_dma();
-						return 0;
-					}
+					ctx->StartError=RealTimeNs()-ctx->StartAt;
+					printf("Start error %+.1fus\n",ctx->StartError/1e3);
 				}
+				SchedStart(&ctx->RefillSched,Pos.Played);
+			
+				Init=0;
 				
-				for(i=0;i<DmaSampleBurstSize;i++)
-				{
-					//static float samplerate=48000;
-					static int amp;
-					static double df;
-					
-					int CorrectionRpiFrequency=-1000; //TODO PPM / Offset=1KHZ at 144MHZ
-					
-					CompteSample++;
-					//printf("i%d q%d\n",IQArray[2*i],IQArray[2*i+1]);
-					
-					IQToFreqAmp(IQFloatArray[2*i+1]*32767,IQFloatArray[2*i]*32767,&df,&amp,SampleRate);
-
-					if(amp>Max) Max=amp;
-					if(amp<Min) Min=amp;
-					/*	
-					if((CompteSample%4800)==0)
-					{
-						//printf("%d\n",((CompteSample/48000)*1024)%32767);
-						printf("Amp %d Freq %f MinAmp %d MaxAmp %d\n",amp,df,Min,Max);
-						// printf(".");
-						fflush(stdout);
-					}
-					*/
-					// TEST - WARNING, REMOVE FOR RELEASE 
-					//amp=((CompteSample/48000)*1024)%32767;
-					//df=0;
-					//amp=amp*10;
-					//amp=32767;
-					//if(df<OffsetModulation+100) amp=0;
-					//
-					//amp=32767;
-					//if(df>SampleRate/2) df=SampleRate/2-df;
-					FrequencyAmplitudeToRegister((GlobalTuningFrequency-OffsetModulation+df/HarmonicNumber)/HarmonicNumber,amp,last_sample++,0,SampleRate,NoUsePwmFrequency,CompteSample%2);
-						
-					free_slots--;
-					if (last_sample == NUM_SAMPLES)	last_sample = 0;
-				}
+				continue;
 			}
-		// *************************************** MODE RF **************************************************
-			if((Mode==MODE_RF)||(Mode==MODE_RFA))
+		}
+		else
+		{
+			uint64_t LastPlayed=Pos.Played;
+			int Queued;
+
+			DmaPosUpdate(&Pos,DmaPlayingSample(ctx,&Pos));
+			StatAdd(&ctx->Stat->SlotsPlayed,Pos.Played-LastPlayed);
+			// Flags : the position only moves by bursts, measure the rate on each move
+			if((ctx->DmaDone==NULL)||(Pos.Played!=ctx->RefillSched.LastPlayed))
+				SchedUpdate(&ctx->RefillSched,Pos.Played);
+			if(DmaPosQueued(&Pos)<=0) // DMA plays slots of its previous lap : refill ahead of it
 			{
-				// SHOULD NOT EXEED 200 STEP*500ns; SAMPLERATE SHOULD BE MAX TO HAVE PRECISION FOR PCM 
-				// BUT FIFO OF PCM IS 16 : SAMPLERATE MAYBE NOT EXCESS 16*80000 ! CAREFULL BUGS HERE
-				#define MAX_DELAY_WAIT (PWM_STEP_MAXI/2*FREQ_MINI_TIMING-PWMF_MARGIN) 
-				static int CompteSample=0;
-				static uint32_t TimeRemaining=0;
-				static samplerf_t SampleRf;
-				static int NbRead;
-				CompteSample++;
-				int i;
-				for(i=0;i<DmaSampleBurstSize;i++)
-				{
-					if(TimeRemaining==0)
-					{
-						NbRead=readWrapper(&SampleRf,sizeof(samplerf_t));
-						if(NbRead!=sizeof(samplerf_t)) 
-						{
-							if(loop_mode_flag==1)
-							{
-								//printf("Looping FileIn\n");
-								reset();
-								NbRead=readWrapper(&SampleRf,sizeof(samplerf_t));
-							}
-							else if (!useStdin)
-							{
-								stop_dma();
-								return 0;
-							}
-						}
-							
-						TimeRemaining=SampleRf.WaitForThisSample;
-						//TimeRemaining=50000;//SampleRf.WaitForThisSample;
-						debug=1;
-						//printf("A=%f Time =%d \n",SampleRf.Frequency,SampleRf.WaitForThisSample);
-					}
-					else
-						debug=0;	
-					
-					static int amp=32767;
-					static int WaitSample=0;
-					
-					if(TimeRemaining>MAX_DELAY_WAIT) 
-						WaitSample=MAX_DELAY_WAIT;	
-					else
-						WaitSample=TimeRemaining;
-					
-					//printf("TimeRemaining %d WaitSample %d\n",TimeRemaining,WaitSample);
-					if(Mode==MODE_RF)
-					{
-						if(SampleRf.Frequency==0.0)
-						{
-							amp=0;
-							SampleRf.Frequency=00.0;// TODO change that ugly frequency
-						}
-						else
-							amp=32767;
-						FrequencyAmplitudeToRegister((SampleRf.Frequency/HarmonicNumber+GlobalTuningFrequency)/HarmonicNumber,amp,last_sample++,WaitSample,0,NoUsePwmFrequency,debug);
-					}
-					if(Mode==MODE_RFA)
-						FrequencyAmplitudeToRegister((GlobalTuningFrequency)/HarmonicNumber,SampleRf.Frequency,last_sample++,WaitSample,0,NoUsePwmFrequency,debug);
-
-					TimeRemaining-=WaitSample;
-					free_slots--;
-					if (last_sample == NUM_SAMPLES)	last_sample = 0;
-				}
+				StatAdd(&ctx->Stat->DmaUnderruns,1);
+				DmaPosSkip(&Pos,ctx->DmaSampleBurstSize);
 			}
-				
-		// *************************************** MODE VFO **************************************************
-			if(Mode==MODE_VFO)
+			Queued=DmaPosQueued(&Pos);
+			if(ctx->NUM_SAMPLES-Queued < ctx->DmaSampleBurstSize) // DMA is full : sleep until it falls to the fill target
 			{
-				static uint32_t CompteSample=0;
-					
-				int i;
-				//printf("Begin free %d\n",free_slots);
-				for(i=0;i<DmaSampleBurstSize;i++)
-				{						
-					//To be fine tuned !!!!	
-					static int OutputPower=32767;
-					CompteSample++;
-					debug=1;//(debug+1)%2;	
-					//OutputPower=(CompteSample/10)%32768;
-
-					FrequencyAmplitudeToRegister(GlobalTuningFrequency/HarmonicNumber/*+(CompteSample*0.1)*/,OutputPower,last_sample++,25000,0,NoUsePwmFrequency,debug);
-					free_slots--;
-					//printf("%f \n",GlobalTuningFrequency+(((CompteSample/10)*1)%50000));	
-					if (last_sample == NUM_SAMPLES)	last_sample = 0;
-					if(CompteSample%40000==0)
-					{
-						//OutputPower=(OutputPower+1)%8;
-						//pad_gpios_reg[PADS_GPIO_0] = 0x5a000000 + (OutputPower&0x7) + (1<<4) + (0<<3); // Set output power for I/Q GPIO18/GPIO19 
-						//printf("Freq %d Outputpower=%d\n",CompteSample/20000,OutputPower);
-					}
-					//usleep(1);
-				}
-					//printf("End free %d\n",free_slots);
+				SchedSleepUntil(&ctx->RefillSched,SchedDeadline(&ctx->RefillSched,Queued));
+				continue;
 			}
-
+			StatHeadroom(ctx->Stat,Queued);
 		}
 			
-		clock_gettime(CLOCK_REALTIME, &gettime_now);
-		time_difference = gettime_now.tv_nsec - start_time;
-		if(time_difference<0) time_difference+=1E9;
+		FirstSample=Pos.WriteSlot;
+		if((ctx->RenderFileName!=NULL)&&(ctx->RenderSamples!=0)&&(Pos.Written>=ctx->RenderSamples)) break; // Render length reached
+
+		if(RingCount(&Ring)<ctx->DmaSampleBurstSize)
+		{
+			if(RingIsEnd(&Ring)&&(RingCount(&Ring)<ctx->DmaSampleBurstSize)) break; // End of input
+			SchedSleepUntil(&ctx->RefillSched,SchedNow()+REFILL_POLL_NS); // Input thread is late
+			continue;
+		}
+		RefillStart=SchedNow();
+		RefillKernel(ctx,&Ring,FirstSample,ctx->DmaSampleBurstSize);
+		DmaPosWrite(&Pos,ctx->DmaSampleBurstSize);
+		RingRelease(&Ring,ctx->DmaSampleBurstSize);
+		StatRefillTime(ctx->Stat,SchedNow()-RefillStart);
+		StatAdd(&ctx->Stat->Bursts,1);
 			
-		last_cb = (uint32_t)virtbase + last_sample * sizeof(dma_cb_t) * CBS_SIZE_BY_SAMPLE;
+		if(ctx->RenderFileName!=NULL)
+		{
+			int Count=ctx->DmaSampleBurstSize;
+			if((ctx->RenderSamples!=0)&&(Pos.Written>ctx->RenderSamples)) Count-=Pos.Written-ctx->RenderSamples;
+			RenderSamples(ctl,FirstSample,Count,ctx->NUM_SAMPLES);
+		}
 	}
 				
-	stop_dma();
+	__atomic_store_n(&Input.Stop,1,__ATOMIC_RELEASE);
+	pthread_join(InputThreadId,NULL);
+	RingFree(&Ring);
+	free(Input.IQRawArray);
+	free(Input.IQFloat);
+	free(Input.Resampled);
+	ResamplerFree(&Input.Resampler);
+	BlockInputFree(&Input.Block);
+	free(Input.FreqArray);
+	free(Input.AmpArray);
+	StatSet(&ctx->Stat->Running,0);
+	if(ctx->CalibRefresh) RefreshCalibration(ctx);
+	stop_dma(ctx);
 	return(0);
 }
 
@@ -1,16 +1,151 @@
 #ifndef RPITX_H
 #define RPITX_H
 #include <ctype.h>
-
-int pitx_init(int SampleRate, double TuningFrequency, int* skipSignals,int SetDma);
-int pitx_SetTuneFrequencyu(uint32_t Frequency);
+#include <stdint.h>
+#include <sys/types.h>
+#include "RpiDma.h"
+#include "RpiSched.h"
+#include "RpiStat.h"
+#include "RpiInput.h"
+#include "RpiStream.h"
+#include "RpiRing.h"
+#include "RpiCalib.h"
 
 #define MODE_IQ 0
 #define MODE_RF 1
 #define MODE_RFA 2
 #define MODE_IQ_FLOAT 3
 #define MODE_VFO 4
+#define MODE_IQ_CU8 5
+#define MODE_IQ_CS8 6
+
+#define CALIB_MEASURE 0 // Always measure (cache updated)
+#define CALIB_CHECK 1
+#define CALIB_TRUST 2
+#define CALIB_FULL 3 // Always measure, with the timing table of every step count
+
+#define PWM_BANK_SIZE 16 // Pre-shuffled F1/F2 permutations for -r (power of 2)
+#define PWM_BANK_WAYS 4 // Banks kept for different word counts (RF splits long records)
+
+// F1/F2 interleaving of FrequencyTab : for a given PwmNumberStep and margin it only depends
+// on AdaptPWMFrequency. Pairs of F1,F2 first, then a run of the remaining register.
+typedef struct {
+	uint16_t Pairs;
+	uint16_t Run;
+	uint8_t RunIsF1;
+} pwmpattern_t;
+
+// Divider band : every TuneFrequency in ]f1,f2] use the same F1/F2 registers
+typedef struct {
+	uint32_t PllUsed;
+	double f1;
+	double f2; // f2 is the higher frequency
+	uint32_t RegisterF1;
+	uint32_t RegisterF2;
+	int NbStep; // PwmNumberStep used for StepScale
+	double StepScale; // NbStep/(f2-f1)
+} freqband_t;
+
+// Transmitter context : peripherals and DMA memory are opened once (pitx_open),
+// then any number of pitx_run_ctx can be done with the same context.
+// Options can be changed between two pitx_run_ctx.
+// Only one context can be open at a time in a process (the DMA arena, channel and
+// backend are process wide) : pitx_open fails until the previous one is pitx_close'd.
+typedef struct pitx_ctx {
+	// Options
+	int DmaSampleBurstSize;
+	int NUM_SAMPLES; // Slots used in the DMA ring (<=NUM_SAMPLES_MAX)
+	int Randomize; // Randomize PWM frequency
+	int UsePCMClk; // Output on GPCLK instead of PWM
+	int RefillFillPercent; // Refill when DMA buffer falls to this % of NUM_SAMPLES
+	unsigned char loop_mode_flag;
+	int useStdin; // Keep going on short reads
+	char *RenderFileName; // Offline render instead of DMA
+	uint64_t RenderSamples; // Render stops after this many samples, 0 : end of input (never for VFO or loop mode)
+	mapinput_t *InputMap; // Input file mapped by the caller, NULL : readWrapper
+	streaminput_t *Stream; // Streaming server opened by the caller (--listen), replaces the file
+	int DmaRate; // IQ resampled to this rate, 0 : input rate (raised if too slow for PWM_STEP_MAXI)
+	int DoubleBuffer; // DMA writes a flag after each burst, refill waits for it instead of polling the CB position
+	int64_t StartAt; // CLOCK_REALTIME ns : the ring is primed, then the DMA waits for it. 0 : start once primed
+	int64_t StartError; // ns the DMA started after StartAt (last timed run)
+
+	// DMA timing (calibrated on first run)
+	int FREQ_MINI_TIMING;
+	int PWMF_MARGIN;
+	int globalppmpll;
+	char Calibrated;
+	int CalibMode; // CALIB_MEASURE, CALIB_CHECK (cache entry checked by a quick measure) or CALIB_TRUST
+	const char *CalibFile; // Calibration cache (CALIB_CACHE_FILE)
+	char CalibKey[CALIB_KEY_MAX];
+	char CalibRefresh; // Cache entry is old : measured again at the end of the run
+	// Timing table (CALIB_FULL, or its cache entry) : Timing[n] is the ns of a slot of n FrequencyTab words.
+	// Samples then get the step count of their duration, the sub-step remainder is carried to the next ones
+	int NbTiming; // 0 : linear model (FREQ_MINI_TIMING)
+	uint32_t Timing[CALIB_TIMING_MAX];
+	uint32_t TimingWait; // Last WaitNanoSecond looked up, 0 : none
+	int TimingStep; // Its PwmNumberStep (slot no longer than the sample)
+	double TimingFrac; // Fraction of a step missing to TimingStep
+	double TimingCarry; // Accumulated fractions, a step is added when it reaches 1
+
+	// Plls and tuning
+	uint32_t PllFreq500MHZ;
+	uint32_t PllFreq1GHZ;
+	uint32_t PllFreq19MHZ;
+	uint32_t PllUsed;
+	char PllNumber;
+	double GlobalTuningFrequency;
+	int HarmonicNumber;
+	uint32_t Originfsel;
+
+	// Encoder caches
+	char ShowInfo;
+	freqband_t FreqBand;
+	// [PwmNumberStep&1][AdaptPWMFrequency] : both step counts of a timing table sample stay cached
+	pwmpattern_t PwmPattern[2][PWM_STEP_MAXI+1];
+	int PwmPatternNbStep[2];
+	int PwmPatternMargin[2];
+	// Randomize : PWM_BANK_SIZE shuffles of the ranks 0..PwmBankNbWord-1,
+	// word j is F1 if its rank is below the number of F1 words of the pattern
+	uint8_t PwmBank[PWM_BANK_WAYS][PWM_BANK_SIZE][PWM_STEP_MAXI];
+	int PwmBankNbWord[PWM_BANK_WAYS];
+	int PwmBankNext; // Way replaced on miss
+	uint32_t DitherState; // xorshift32, reseeded each run (reproducible render)
+	// Sample encoded in each DMA slot : an identical sample is not encoded again
+	// (VFO, long RF tones), Frequency NAN : slot must be encoded
+	txsample_t SlotSample[NUM_SAMPLES_MAX];
+	uint8_t SlotStep[NUM_SAMPLES_MAX]; // PwmNumberStep of each slot (timing table : steps of a same sample differ)
+	// Cached copy of the slots : samples are encoded here, then copied to the
+	// uncached DMA arena by runs of slots (PublishSlots)
+	uint32_t *Staging; // NUM_SAMPLES slots of SampleWords words
+	size_t StagingSize;
+	uint32_t StagingLength[NUM_SAMPLES_MAX]; // FrequencyTab bytes : length of the 3rd CB
+	// DoubleBuffer : a flag CB after each burst copies the burst index to DmaDone
+	volatile uint32_t *DmaDone; // Last burst played, NULL : CB position polling
+	int DmaBursts;
+
+	refillsched_t RefillSched;
+	rpitx_stat_t *Stat; // Shared memory statistics (rpitx-stat)
+} pitx_ctx;
+
+// Init peripherals (Backend) and DMA memory, NULL on failure or if a context is already open
+pitx_ctx *pitx_open(int* skipSignals,int SetDma);
+
+int pitx_run_ctx(
+	pitx_ctx *ctx,
+	char Mode,
+	int SampleRate,
+	float SetFrequency,
+	float ppmpll,
+	char NoUsePwmFrequency,
+	// Wrapper around read to read wav file bytes
+	ssize_t (*readWrapper)(void *buffer, size_t count),
+	// Wrapper to reset file for looping
+	void (*reset)(void)
+);
+
+void pitx_close(pitx_ctx *ctx);
 
+// One shot transmission : pitx_open, pitx_run_ctx, pitx_close
 int pitx_run(
 	char Mode,
 	int SampleRate,
@@ -0,0 +1,220 @@
+/*
+	bench-iq : IQ to Frequency/Amplitude conversion speed, in ns/sample
+
+	bench-iq [burst (default 1000)] [seconds by test (default 1)]
+	Times the per sample IQToFreqAmp that rpitx used before RpiIQ.c against
+	IQToFreqAmpBlock/IQFloatToFreqAmpBlock, with their vector path (NEON or SSE2,
+	as built) and their plain C path, on the same burst.
+	Build with the CFLAGS of rpitx (e.g. -mfpu=neon on Pi2/Pi3) to measure what it runs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "RpiIQ.h"
+
+// Plain C copy of RpiIQ.c
+#define IQ_NO_SIMD
+#define IQToFreqAmpBlock IQToFreqAmpBlockScalar
+#define IQFloatToFreqAmpBlock IQFloatToFreqAmpBlockScalar
+#define IQ8ToFreqAmpBlock IQ8ToFreqAmpBlockScalar
+#define IQ16ToFloat IQ16ToFloatScalar
+#define IQ8ToFloat IQ8ToFloatScalar
+#include "RpiIQ.c"
+#undef IQToFreqAmpBlock
+#undef IQFloatToFreqAmpBlock
+#undef IQ8ToFreqAmpBlock
+#undef IQ16ToFloat
+#undef IQ8ToFloat
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define VECTOR_NAME "NEON"
+#elif defined(__SSE2__)
+#define VECTOR_NAME "SSE2"
+#else
+#define VECTOR_NAME "C (no vector unit)"
+#endif
+
+#define SAMPLE_RATE 48000
+
+// ************************* Per sample conversion replaced by RpiIQ.c *************************
+
+static int arctan2(int y, int x)
+{
+	int abs_y = abs(y);
+	int angle;
+	if((x==0)&&(y==0)) return 0;
+	if(x >= 0){
+		angle = 45 - 45 * (x - abs_y) / ((x + abs_y)==0?1:(x + abs_y));
+	} else {
+		angle = 135 - 45 * (x + abs_y) / ((abs_y - x)==0?1:(abs_y - x));
+	}
+	return (y < 0) ? -angle : angle; // negate if in quad III or IV
+}
+
+static void IQToFreqAmp(int I,int Q,double *Frequency,int *Amp,int SampleRate)
+{
+	double phase;
+	static double prev_phase = 0;
+
+	*Amp=round(sqrt( I*I + Q*Q)/sqrt(2));
+	if(*Amp>32767)
+	{
+		printf("!");
+		*Amp=32767; //Overload
+	}
+
+	phase = M_PI + ((float)arctan2(I,Q)) * M_PI/180.0f;
+	double dp = phase - prev_phase;
+	if(dp < 0) dp = dp + 2*M_PI;
+
+	*Frequency = dp*SampleRate/(2.0f*M_PI);
+	prev_phase = phase;
+}
+
+// ************************* Bench *************************
+
+typedef struct {
+	int Burst;
+	const int16_t *IQ;
+	const float *IQFloat;
+	float *Frequency;
+	int *Amp;
+	float PrevPhase;
+	double Sum; // Keeps the results alive
+} bench_t;
+
+typedef void (*bench_fn_t)(bench_t *B);
+
+static void BenchOld16(bench_t *B)
+{
+	int i;
+	for(i=0;i<B->Burst;i++)
+	{
+		double df;
+		int amp;
+		IQToFreqAmp(B->IQ[2*i+1],B->IQ[2*i],&df,&amp,SAMPLE_RATE);
+		B->Frequency[i]=df;
+		B->Amp[i]=amp;
+	}
+}
+
+static void BenchOldFloat(bench_t *B)
+{
+	int i;
+	for(i=0;i<B->Burst;i++)
+	{
+		double df;
+		int amp;
+		IQToFreqAmp(B->IQFloat[2*i+1]*32767,B->IQFloat[2*i]*32767,&df,&amp,SAMPLE_RATE);
+		B->Frequency[i]=df;
+		B->Amp[i]=amp;
+	}
+}
+
+static void BenchBlock16(bench_t *B)
+{
+	IQToFreqAmpBlock(B->IQ,B->Burst,SAMPLE_RATE,&B->PrevPhase,B->Frequency,B->Amp);
+}
+
+static void BenchScalar16(bench_t *B)
+{
+	IQToFreqAmpBlockScalar(B->IQ,B->Burst,SAMPLE_RATE,&B->PrevPhase,B->Frequency,B->Amp);
+}
+
+static void BenchBlockFloat(bench_t *B)
+{
+	IQFloatToFreqAmpBlock(B->IQFloat,B->Burst,SAMPLE_RATE,&B->PrevPhase,B->Frequency,B->Amp);
+}
+
+static void BenchScalarFloat(bench_t *B)
+{
+	IQFloatToFreqAmpBlockScalar(B->IQFloat,B->Burst,SAMPLE_RATE,&B->PrevPhase,B->Frequency,B->Amp);
+}
+
+static double NowNs(void)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return Now.tv_sec*1e9+Now.tv_nsec;
+}
+
+// ns/sample of Fn, bursts repeated during Seconds
+static double Run(bench_t *B,bench_fn_t Fn,double Seconds)
+{
+	double Start=NowNs();
+	double Elapsed;
+	long Bursts=0;
+	int i;
+
+	do
+	{
+		Fn(B);
+		Bursts++;
+		Elapsed=NowNs()-Start;
+	}
+	while(Elapsed<Seconds*1e9);
+	for(i=0;i<B->Burst;i++) B->Sum+=B->Frequency[i]+B->Amp[i];
+	return Elapsed/((double)Bursts*B->Burst);
+}
+
+int main(int argc,char *argv[])
+{
+	bench_t B;
+	double Seconds=(argc>2)?atof(argv[2]):1.0;
+	int16_t *IQ;
+	float *IQFloat;
+	uint32_t Noise=0x2545F491;
+	double Old;
+	int i;
+
+	B.Burst=(argc>1)?atoi(argv[1]):1000;
+	if((B.Burst<=0)||(Seconds<=0))
+	{
+		fprintf(stderr,"Usage : bench-iq [burst (default 1000)] [seconds by test (default 1)]\n");
+		exit(1);
+	}
+	IQ=malloc(2*B.Burst*sizeof(int16_t));
+	IQFloat=malloc(2*B.Burst*sizeof(float));
+	B.Frequency=malloc(B.Burst*sizeof(float));
+	B.Amp=malloc(B.Burst*sizeof(int));
+	if((IQ==NULL)||(IQFloat==NULL)||(B.Frequency==NULL)||(B.Amp==NULL))
+	{
+		fprintf(stderr,"bench-iq : out of memory\n");
+		exit(1);
+	}
+	// Tone with a varying level and some noise (no overload)
+	for(i=0;i<B.Burst;i++)
+	{
+		double Level=0.2+0.7*fabs(sin(2*M_PI*i/B.Burst));
+		double Phase=2*M_PI*1234.5*i/SAMPLE_RATE;
+		Noise^=Noise<<13;
+		Noise^=Noise>>17;
+		Noise^=Noise<<5;
+		IQFloat[2*i+1]=Level*cos(Phase)+((Noise&0xFFFF)-32768)/3276800.0; // I
+		IQFloat[2*i]=Level*sin(Phase)+((Noise>>16)-32768)/3276800.0; // Q
+		IQ[2*i+1]=(int16_t)lrint(IQFloat[2*i+1]*32767);
+		IQ[2*i]=(int16_t)lrint(IQFloat[2*i]*32767);
+	}
+	B.IQ=IQ;
+	B.IQFloat=IQFloat;
+	B.PrevPhase=0;
+	B.Sum=0;
+
+	printf("Burst of %d samples, %.1fs by test\n",B.Burst,Seconds);
+	Old=Run(&B,BenchOld16,Seconds);
+	printf("int16 IQToFreqAmp (per sample)       %7.2f ns/sample\n",Old);
+	printf("int16 IQToFreqAmpBlock %-13s %7.2f ns/sample\n",VECTOR_NAME,Run(&B,BenchBlock16,Seconds));
+	printf("int16 IQToFreqAmpBlock C             %7.2f ns/sample\n",Run(&B,BenchScalar16,Seconds));
+	Old=Run(&B,BenchOldFloat,Seconds);
+	printf("float IQToFreqAmp (per sample)       %7.2f ns/sample\n",Old);
+	printf("float IQFloatToFreqAmpBlock %-8s %7.2f ns/sample\n",VECTOR_NAME,Run(&B,BenchBlockFloat,Seconds));
+	printf("float IQFloatToFreqAmpBlock C        %7.2f ns/sample\n",Run(&B,BenchScalarFloat,Seconds));
+	if(B.Sum==0) printf("\n"); // Results are used
+	free(IQ);
+	free(IQFloat);
+	free(B.Frequency);
+	free(B.Amp);
+	return 0;
+}
@@ -14,22 +14,16 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
+#include "../src/RpiFt.h"
+
 int FilePicture;
 int FileFreqTiming;
+ftwriter_t FtWriter;
 static double GlobalTuningFrequency=00000.0;
 
 void playtone(double Frequency,uint32_t Timing)
 {
-	typedef struct {
-		double Frequency;
-		uint32_t WaitForThisSample;
-	} samplerf_t;
-	samplerf_t RfSample;
-	
-	RfSample.Frequency=GlobalTuningFrequency+Frequency;
-	RfSample.WaitForThisSample=Timing*100L; //en 100 de nanosecond
-	//printf("Freq =%f Timing=%d\n",RfSample.Frequency,RfSample.WaitForThisSample);
-	if (write(FileFreqTiming,&RfSample,sizeof(samplerf_t)) != sizeof(samplerf_t)) {
+	if (!FtWrite(&FtWriter,GlobalTuningFrequency+Frequency,Timing*100L)) {
 		fprintf(stderr, "Unable to write sample");
 	}
 }
@@ -147,7 +141,8 @@ int main(int argc, char **argv)
 		FilePicture = open(argv[1], O_RDONLY);
 		
 		char *sFileFreqTiming=(char *)argv[2];
-		FileFreqTiming = open(argv[2], O_WRONLY|O_CREAT, 0644);
+		FileFreqTiming = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		FtWriterOpen(&FtWriter,FileFreqTiming,FT_VERSION_2,FT_MODE_RF,0);
 	}
 	else
 	{
@@ -157,6 +152,7 @@ int main(int argc, char **argv)
 		
 	ProcessMartin1();
 	close(FilePicture);
+	FtWriterClose(&FtWriter);
 	close(FileFreqTiming);
 	return 0;
 }